@@ -0,0 +1,295 @@
+// bench.cpp
+// Throughput benchmark for rom2msx: read, the --type auto scan, placement
+// (alone and with --checksum), write, verify and the --verify-dump readback
+// comparison are timed separately on synthetic ROMs of every size (8 KiB up
+// to what the chip/mapper allows) for each --type and --chip combination.
+//
+// Build/run: make bench
+//
+// Usage:
+//   rom2msx_bench [--iters N] [--dir scratch_dir] [--cold]
+//
+// - Warm runs repeat each step with the files in the page cache.
+// - With --cold, every read-side step is also run after dropping the file
+//   from the page cache (fdatasync + POSIX_FADV_DONTNEED), which approximates
+//   a first touch of the file on local storage.
+// - Read and write are measured for each I/O backend the converter can use:
+//   "stream" (ifstream/ofstream, the fallback path), "mmap" (InputFile /
+//   OutputFile), "writev" (write_spans, raw images straight from the ROM),
+//   "windows" (write_windows with the mapped check, chips above 512 KiB only),
+//   "pread"/"pwrite" as a plain system call baseline and, for reads, "uring"
+//   (one read through io_uring, as the --batch prefetcher queues them; Linux
+//   only, skipped where io_uring is refused). These all write
+//   the file in place; "staged" is writev through a temporary name renamed
+//   over the output, as conversions do, so the difference to "writev" is the
+//   cost of the atomic replace.
+// - Reported figures are the median over the iterations, in MiB/s of the
+//   bytes the step touches (ROM bytes for read, chip bytes otherwise).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rom2msx.hpp"
+#include "rom2msx_io.hpp"
+
+using rom2msx::BANK_SIZE;
+using rom2msx::CartType;
+using rom2msx::Placement;
+using rom2msx::Status;
+using rom2msx::type_name;
+using rom2msx::io::Clock;
+using rom2msx::io::InputFile;
+using rom2msx::io::OutputFile;
+using rom2msx::io::StagedFile;
+using rom2msx::io::Stats;
+using rom2msx::io::Stopwatch;
+using rom2msx::io::WINDOW_BYTES;
+using rom2msx::io::ok;
+using rom2msx::io::put_file;
+using rom2msx::io::read_file;
+using rom2msx::io::verify_file;
+using rom2msx::io::verify_image;
+using rom2msx::io::write_file;
+using rom2msx::io::write_spans;
+using rom2msx::io::write_windows;
+#ifdef ROM2MSX_IO_URING
+using rom2msx::io::Ring;
+#endif
+
+namespace {
+
+void die(const std::string& msg) {
+    std::cerr << "Error: " << msg << std::endl;
+    std::exit(1);
+}
+
+struct Case {
+    CartType type;
+    int chip_kib;
+    size_t rom_bytes;
+};
+
+// Drop a file's pages from the page cache so the next access goes to storage.
+void drop_cache(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0.0 : v[v.size() / 2];
+}
+
+class Bench {
+public:
+    Bench(std::string dir, int iters, bool cold) : dir_(std::move(dir)), iters_(iters), cold_(cold) {
+#ifdef ROM2MSX_IO_URING
+        ring_ok_ = ring_.init(1); // kernels or sandboxes may refuse io_uring
+#endif
+    }
+
+    // Time fn() iters_ times (after setup() each time) and print the median
+    // throughput over `bytes`.
+    template <class Setup, class Fn>
+    void run(const Case& c, const char* step, const char* backend, size_t bytes, bool cold, Setup setup, Fn fn) {
+        std::vector<double> mibs;
+        for (int k = 0; k < iters_; ++k) {
+            setup();
+            auto t0 = Clock::now();
+            if (!fn()) {
+                std::cerr << "bench: " << step << "/" << backend << " failed\n";
+                std::exit(1);
+            }
+            double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+            mibs.push_back(bytes / (1024.0 * 1024.0) / std::max(secs, 1e-9));
+        }
+        std::printf("%-9s %5d  %6zu  %-7s %-7s %-4s %10.1f\n", type_name(c.type), c.chip_kib, c.rom_bytes / 1024,
+                    step, backend, cold ? "cold" : "warm", median(mibs));
+    }
+
+    void case_(const Case& c) {
+        std::string rom_path = dir_ + "/bench.rom";
+        std::string out_path = dir_ + "/bench.bin";
+        size_t chip_bytes = static_cast<size_t>(c.chip_kib) * 1024;
+        std::string err;
+
+        // Deterministic ROM contents (xorshift), no 0xFF runs to skip.
+        std::vector<uint8_t> rom(c.rom_bytes);
+        uint32_t x = 0x2463534Bu ^ static_cast<uint32_t>(c.rom_bytes);
+        for (auto& b : rom) {
+            x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+            b = static_cast<uint8_t>(x % 0xFF);
+        }
+        if (!write_file(rom_path, rom.data(), rom.size(), err)) die(err);
+
+        rom2msx::Options opt;
+        opt.type = c.type;
+        opt.chip_kib = c.chip_kib;
+        Placement p;
+        if (!ok(rom2msx::plan_layout(opt, rom.size(), p), err)) die(err);
+        p.rom = rom.data();
+        std::vector<uint8_t> img(chip_bytes);
+        auto nothing = [] {};
+
+        for (bool cold : {false, true}) {
+            if (cold && !cold_) break;
+            auto setup = [&] { if (cold) drop_cache(rom_path); };
+            run(c, "read", "stream", rom.size(), cold, setup, [&] {
+                std::vector<uint8_t> buf;
+                return read_file(rom_path, buf, err);
+            });
+            run(c, "read", "mmap", rom.size(), cold, setup, [&] {
+                // Touch every page so the mapping cost isn't deferred.
+                InputFile in;
+                if (!in.open(rom_path, err)) return false;
+                volatile uint8_t sink = 0;
+                for (size_t i = 0; i < in.size(); i += 4096) sink = sink + in.data()[i];
+                return true;
+            });
+            run(c, "read", "pread", rom.size(), cold, setup, [&] {
+                std::vector<uint8_t> buf(rom.size());
+                int fd = ::open(rom_path.c_str(), O_RDONLY);
+                if (fd < 0) return false;
+                ssize_t n = pread(fd, buf.data(), buf.size(), 0);
+                ::close(fd);
+                return n == static_cast<ssize_t>(buf.size());
+            });
+#ifdef ROM2MSX_IO_URING
+            // One read through the batch prefetcher's ring, without the
+            // read-ahead: what a job costs when nothing overlaps it.
+            if (ring_ok_) {
+                run(c, "read", "uring", rom.size(), cold, setup, [&] {
+                    std::vector<uint8_t> buf(rom.size());
+                    int fd = ::open(rom_path.c_str(), O_RDONLY);
+                    if (fd < 0) return false;
+                    uint64_t tag = 0;
+                    int res = -1;
+                    bool done = ring_.read(fd, buf.data(), buf.size(), 0, 0) && ring_.wait(tag, res);
+                    ::close(fd);
+                    return done && res == static_cast<int>(buf.size());
+                });
+            }
+#endif
+        }
+
+        run(c, "scan", "memory", rom.size(), false, nothing,
+            [&] { return rom2msx::detect_mapper(rom).hits != ~0u; });
+        run(c, "place", "memory", chip_bytes, false, nothing,
+            [&] { return ok(rom2msx::convert(rom, opt, img), err); });
+        run(c, "place", "sums", chip_bytes, false, nothing, [&] {
+            rom2msx::ImageChecksum sums;
+            return ok(rom2msx::convert(rom, opt, img, nullptr, &sums), err);
+        });
+
+        run(c, "write", "stream", chip_bytes, false, nothing,
+            [&] { return put_file(out_path, img.data(), img.size(), err); });
+        run(c, "write", "mmap", chip_bytes, false, nothing, [&] {
+            OutputFile out;
+            if (!out.create(out_path, chip_bytes, true, err)) return false;
+            std::memcpy(out.data(), img.data(), chip_bytes);
+            return out.commit(err);
+        });
+        run(c, "write", "writev", chip_bytes, false, nothing, [&] {
+            Stopwatch sw;
+            Stats st;
+            return write_spans(out_path, chip_bytes, &p, 1, nullptr, sw, st, err);
+        });
+        run(c, "write", "staged", chip_bytes, false, nothing, [&] {
+            Stopwatch sw;
+            Stats st;
+            StagedFile out(out_path);
+            return write_spans(out.tmp(), chip_bytes, &p, 1, nullptr, sw, st, err) && out.publish(nullptr, err);
+        });
+        if (chip_bytes > WINDOW_BYTES) {
+            // The 1-8 MiB parts' path when the image has to be rendered
+            // (--verify=mapped): window by window through one buffer.
+            std::vector<uint8_t> win;
+            run(c, "write", "windows", chip_bytes, false, nothing, [&] {
+                Stopwatch sw;
+                Stats st;
+                return write_windows(out_path, chip_bytes, &p, 1, true, nullptr, win, sw, st, err);
+            });
+        }
+        run(c, "write", "pwrite", chip_bytes, false, nothing, [&] {
+            int fd = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) return false;
+            ssize_t n = pwrite(fd, img.data(), img.size(), 0);
+            return ::close(fd) == 0 && n == static_cast<ssize_t>(img.size());
+        });
+
+        run(c, "verify", "memory", chip_bytes, false, nothing,
+            [&] { return verify_image(img.data(), img.size(), &p, 1, err); });
+        std::vector<uint8_t> dump(img);
+        run(c, "dump", "memory", chip_bytes, false, nothing, [&] {
+            rom2msx::DumpDiff diff;
+            return rom2msx::diff_dump(img, dump, diff) == Status::Ok && diff.sectors.empty();
+        });
+        for (bool cold : {false, true}) {
+            if (cold && !cold_) break;
+            run(c, "verify", "mmap", chip_bytes, cold, [&] { if (cold) drop_cache(out_path); },
+                [&] { return verify_file(out_path, chip_bytes, &p, 1, err); });
+        }
+    }
+
+private:
+    std::string dir_;
+    int iters_;
+    bool cold_;
+#ifdef ROM2MSX_IO_URING
+    Ring ring_;
+    bool ring_ok_ = false;
+#endif
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int iters = 15;
+    bool cold = false;
+    std::string dir;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--iters" && i + 1 < argc) iters = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--dir" && i + 1 < argc) dir = argv[++i];
+        else if (a == "--cold") cold = true;
+        else die("Usage: rom2msx_bench [--iters N] [--dir scratch_dir] [--cold]");
+    }
+    bool own_dir = dir.empty();
+    if (own_dir) {
+        char tmpl[] = "/tmp/rom2msx-bench-XXXXXX";
+        if (!mkdtemp(tmpl)) die("Cannot create scratch directory");
+        dir = tmpl;
+    }
+
+    std::printf("%-9s %5s  %6s  %-7s %-7s %-4s %10s\n", "type", "chip", "romKiB", "step", "backend", "run",
+                "MiB/s");
+    Bench bench(dir, iters, cold);
+    for (CartType type : rom2msx::CART_TYPES) {
+        size_t window = rom2msx::mapper_info(type).window_banks;
+        for (int chip_kib = 64; rom2msx::valid_chip_kib(chip_kib); chip_kib *= 2) {
+            size_t max_bytes = window ? window * BANK_SIZE : static_cast<size_t>(chip_kib) * 1024;
+            for (size_t rom_bytes = BANK_SIZE; rom_bytes <= max_bytes; rom_bytes *= 2) {
+                bench.case_(Case{type, chip_kib, rom_bytes});
+            }
+        }
+    }
+
+    if (own_dir) {
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+    }
+    return 0;
+}
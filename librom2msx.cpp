@@ -0,0 +1,1231 @@
+// librom2msx.cpp
+// Implementation of the conversion library declared in rom2msx.hpp.
+//
+// License: MIT (to align with upstream's permissive license intention).
+
+#include "rom2msx.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rom2msx {
+
+namespace {
+
+void put_le32(std::vector<uint8_t>& v, uint32_t x) {
+    for (int k = 0; k < 4; ++k) v.push_back(static_cast<uint8_t>(x >> (8 * k)));
+}
+
+void put_le16(std::vector<uint8_t>& v, uint16_t x) {
+    v.push_back(static_cast<uint8_t>(x));
+    v.push_back(static_cast<uint8_t>(x >> 8));
+}
+
+void put_hex_byte(std::string& s, unsigned b) {
+    static const char digits[] = "0123456789ABCDEF";
+    s += digits[(b >> 4) & 0xF];
+    s += digits[b & 0xF];
+}
+
+} // namespace
+
+const char* type_name(CartType type) {
+    return mapper_info(type).name;
+}
+
+bool valid_chip_kib(int kib) {
+    return kib >= 64 && kib <= 8192 && (kib & (kib - 1)) == 0;
+}
+
+const char* status_message(Status s) {
+    switch (s) {
+        case Status::Ok:                 return "OK";
+        case Status::BadChipSize:        return "Unsupported chip size (use 64, 128, 256, 512, 1024, 2048, 4096, or 8192 KiB)";
+        case Status::BadAddr:            return "Simple64K start block must be 0..7";
+        case Status::RomTooLargeForS64K: return "ROM too large for Simple64K (max 64 KiB)";
+        case Status::AddrExceedsWindow:  return "Simple64K: --addr + bank_count exceeds 8 banks";
+        case Status::AutoStartNoFit:     return "Simple64K: auto start doesn't fit; try a smaller ROM or pass --addr";
+        case Status::RomLargerThanChip:  return "Input ROM (after 8 KiB padding) is larger than selected chip size";
+        case Status::PlacementOverflow:  return "Output overflow: bank placement exceeds selected chip size";
+        case Status::OutputTooSmall:     return "Output buffer is smaller than the selected chip size";
+        case Status::VerifySizeMismatch: return "output size differs from chip size";
+        case Status::VerifyBankMismatch: return "mismatch in bank";
+        case Status::VerifyNotBlank:     return "non-0xFF found outside written area";
+        case Status::MapperUnknown:      return "no bank switching found in a ROM over 64 KiB";
+        case Status::ArchiveBad:         return "not a valid zip archive";
+        case Status::ArchiveUnsupported: return "unsupported zip member (ZIP64, encrypted or not stored/deflated)";
+        case Status::InflateError:       return "corrupt deflate data in zip member";
+        case Status::ArchiveCrcMismatch: return "CRC-32 mismatch in zip member";
+        case Status::MapperUnsupported:  return "mapper not provided by MegaSCC, RC755 or Simple64K carts";
+        case Status::NotTranslatable:    return "only Konami and ASCII8 bank switching can be translated to Konami SCC";
+    }
+    return "unknown status";
+}
+
+namespace {
+
+// plan_layout() for one mapper policy; the checks of the rules a policy
+// doesn't have fold away.
+template <class M>
+Status plan_for(const Options& opt, size_t rom_bytes, Placement& p) {
+    // Pad input ROM up to multiple of 8 KiB with 0xFF. The padding is never
+    // materialised: the tail of the last bank is simply left at 0xFF.
+    size_t padded = ((rom_bytes + BANK_SIZE - 1) / BANK_SIZE) * BANK_SIZE;
+    size_t in_banks = padded / BANK_SIZE;
+    p.rom_bytes = rom_bytes;
+    p.in_banks = in_banks;
+
+    // A windowed mapper (Simple64K: 64 KiB, 8 banks) can't see past its window.
+    if (M::window_banks && in_banks > M::window_banks) return Status::RomTooLargeForS64K;
+    if (padded > opt.chip_bytes()) return Status::RomLargerThanChip;
+
+    size_t start_bank = M::start_bank(in_banks);
+    if (M::movable && opt.s64k_addr >= 0) {
+        // Use requested block; must fit in the window.
+        start_bank = static_cast<size_t>(opt.s64k_addr);
+        if (start_bank % M::bank_align != 0) return Status::BadAddr;
+        if (M::window_banks && start_bank + in_banks > M::window_banks) return Status::AddrExceedsWindow;
+    } else if (M::window_banks && start_bank + in_banks > M::window_banks) {
+        return Status::AutoStartNoFit;
+    }
+    p.start_bank = start_bank;
+    return Status::Ok;
+}
+
+} // namespace
+
+Status plan_layout(const Options& opt, size_t rom_bytes, Placement& p) {
+    if (!valid_chip_kib(opt.chip_kib)) return Status::BadChipSize;
+    if (opt.s64k_addr < -1 || opt.s64k_addr > 7) return Status::BadAddr;
+    return with_mapper(opt.type, [&](auto m) { return plan_for<decltype(m)>(opt, rom_bytes, p); });
+}
+
+Status place_banks(span<uint8_t> img, const Placement& p) {
+    for (size_t bank = 0; bank < p.in_banks; ++bank) {
+        size_t dst_bank = p.start_bank + bank;
+        size_t dst_off = dst_bank * BANK_SIZE;
+        size_t src_off = bank * BANK_SIZE;
+        if (dst_off + BANK_SIZE > img.size()) return Status::PlacementOverflow;
+        std::memcpy(img.data() + dst_off, p.rom + src_off, std::min(BANK_SIZE, p.rom_bytes - src_off));
+    }
+    return Status::Ok;
+}
+
+Status convert(span<const uint8_t> rom, const Options& opt, span<uint8_t> out, Placement* placed,
+               ImageChecksum* sums) {
+    Placement p;
+    Status s = plan_layout(opt, rom.size(), p);
+    if (s != Status::Ok) return s;
+    p.rom = rom.data();
+    size_t chip_bytes = opt.chip_bytes();
+    if (out.size() < chip_bytes) return Status::OutputTooSmall;
+
+    if ((p.start_bank + p.in_banks) * BANK_SIZE > chip_bytes) return Status::PlacementOverflow;
+    // Place the banks and fill only the gaps around them with 0xFF (erased
+    // state): the leading banks, the padding tail and the rest of the chip.
+    render_window(out.first(chip_bytes), 0, &p, 1, sums);
+    if (placed) *placed = p;
+    return Status::Ok;
+}
+
+// Sixty-four bytes are tested per step with one branch, so the fill regions
+// are checked at memory bandwidth.
+bool all_ff(const uint8_t* p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i ff = _mm_set1_epi8(static_cast<char>(0xFF));
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 48));
+        __m128i v = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ff)) != 0xFFFF) return false;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        if (w != ~uint64_t{0}) return false;
+    }
+    for (; i < n; ++i) {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+void render_window(span<uint8_t> win, size_t offset, const Placement* pl, size_t count, ImageChecksum* sums) {
+    // Only the gaps between ROM data are filled, so every byte is stored once.
+    size_t end = offset + win.size();
+    size_t pos = offset;
+    for (size_t k = 0; k < count; ++k) {
+        const Placement& p = pl[k];
+        size_t lo = p.start_bank * BANK_SIZE;
+        if (lo + p.in_banks * BANK_SIZE <= offset) continue;
+        if (lo >= end) break;
+        size_t a = std::max(lo, offset);
+        size_t b = std::min(lo + p.rom_bytes, end);
+        std::memset(win.data() + (pos - offset), 0xFF, a - pos);
+        if (sums) sums->fill(a - pos);
+        pos = a;
+        // Bank by bank, so sums reads each one while it is still in cache.
+        for (size_t n; pos < b; pos += n) {
+            n = std::min(BANK_SIZE, b - pos);
+            std::memcpy(win.data() + (pos - offset), p.rom + (pos - lo), n);
+            if (sums) sums->data(p.rom + (pos - lo), n);
+        }
+    }
+    std::memset(win.data() + (pos - offset), 0xFF, end - pos);
+    if (sums) sums->fill(end - pos);
+}
+
+Status verify_window(span<const uint8_t> win, size_t offset, const Placement* pl, size_t count, size_t* bad_bank) {
+    size_t end = offset + win.size();
+    size_t pos = offset; // image bytes before pos have been checked
+    auto at = [&](size_t abs) { return win.data() + (abs - offset); };
+    for (size_t k = 0; k < count; ++k) {
+        const Placement& p = pl[k];
+        size_t lo = p.start_bank * BANK_SIZE;
+        size_t hi = lo + p.in_banks * BANK_SIZE;
+        if (hi <= offset) continue;
+        if (lo >= end) break;
+        size_t a = std::max(lo, offset);
+        if (!all_ff(at(pos), a - pos)) return Status::VerifyNotBlank;
+        for (size_t bank = (a - lo) / BANK_SIZE; bank < p.in_banks && lo + bank * BANK_SIZE < end; ++bank) {
+            // The part of this bank inside the window: ROM data, then padding.
+            size_t bank_lo = lo + bank * BANK_SIZE;
+            size_t s = std::max(bank_lo, offset);
+            size_t e = std::min(bank_lo + BANK_SIZE, end);
+            size_t d = std::clamp(lo + p.rom_bytes, s, e);
+            if (std::memcmp(at(s), p.rom + (s - lo), d - s) != 0 || !all_ff(at(d), e - d)) {
+                if (bad_bank) *bad_bank = bank;
+                return Status::VerifyBankMismatch;
+            }
+        }
+        pos = std::min(hi, end);
+    }
+    if (!all_ff(at(pos), end - pos)) return Status::VerifyNotBlank;
+    return Status::Ok;
+}
+
+Status verify(span<const uint8_t> img, const Placement* pl, size_t count, size_t* bad_bank) {
+    for (size_t k = 0; k < count; ++k) {
+        if ((pl[k].start_bank + pl[k].in_banks) * BANK_SIZE > img.size()) return Status::VerifySizeMismatch;
+    }
+    return verify_window(img, 0, pl, count, bad_bank);
+}
+
+const char* mapper_name(RomMapper m) {
+    switch (m) {
+        case RomMapper::None:      return "plain";
+        case RomMapper::Konami:    return "Konami";
+        case RomMapper::KonamiSCC: return "Konami SCC";
+        case RomMapper::ASCII8:    return "ASCII8";
+        case RomMapper::ASCII16:   return "ASCII16";
+        case RomMapper::Other:     return "other";
+    }
+    return "?";
+}
+
+// The scan looks for the 0x32 opcode sixteen bytes at a time and only decodes
+// the operand where it occurs, so a ROM is classified at memory bandwidth.
+// The votes are those of the well-known emulator heuristic: addresses shared
+// by several mappers count for each of them.
+MapperGuess detect_mapper(span<const uint8_t> rom) {
+    enum { Konami, KonamiSCC, ASCII8, ASCII16, Count };
+    unsigned votes[Count] = {};
+    unsigned hits = 0;
+    const uint8_t* d = rom.data();
+    size_t n = rom.size() < 3 ? 0 : rom.size() - 2; // opcode positions with a full operand
+    auto vote = [&](size_t i) {
+        switch (d[i + 1] | d[i + 2] << 8) {
+            case 0x5000: case 0x9000: case 0xB000: votes[KonamiSCC]++; break;
+            case 0x4000: case 0x8000: case 0xA000: votes[Konami]++; break;
+            case 0x6800: case 0x7800:              votes[ASCII8]++; break;
+            case 0x6000: votes[Konami]++; votes[ASCII8]++; votes[ASCII16]++; break;
+            case 0x7000: votes[KonamiSCC]++; votes[ASCII8]++; votes[ASCII16]++; break;
+            case 0x77FF: votes[ASCII16]++; break;
+            default: return;
+        }
+        hits++;
+    };
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i op = _mm_set1_epi8(0x32);
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)), op)));
+        for (; m; m &= m - 1) vote(i + static_cast<size_t>(__builtin_ctz(m)));
+    }
+#endif
+    for (; i < n; ++i) {
+        if (d[i] == 0x32) vote(i);
+    }
+
+    MapperGuess g;
+    g.hits = hits;
+    // ASCII8 shares every address of the others; an ASCII8 game hits
+    // 0x6800/0x7800 plenty, so one stray vote is discounted.
+    if (votes[ASCII8]) votes[ASCII8]--;
+    static const RomMapper order[Count] = {RomMapper::Konami, RomMapper::KonamiSCC, RomMapper::ASCII8,
+                                           RomMapper::ASCII16};
+    int best = -1;
+    for (int k = 0; k < Count; ++k) {
+        if (votes[k] && (best < 0 || votes[k] > votes[best])) best = k;
+    }
+    // A plain ROM has no bank-switch writes to speak of; a few stray byte
+    // sequences in data don't make a megaROM.
+    bool plain = rom.size() <= 0x8000 || (rom.size() <= 0x10000 && (best < 0 || votes[best] < 4));
+    if (plain || best < 0) {
+        g.confidence = plain ? 100 : 0;
+        return g;
+    }
+    g.mapper = order[best];
+    g.score = votes[best];
+    g.confidence = 100 * g.score / hits;
+    return g;
+}
+
+namespace {
+
+// Z80 instruction lengths. base[op] is the length of an unprefixed opcode;
+// mem[op] marks the ones addressing (HL), which an index prefix turns into
+// (IX+d)/(IY+d) with a displacement byte.
+struct Z80Lengths {
+    uint8_t base[256];
+    uint8_t mem[256];
+
+    Z80Lengths() {
+        for (int op = 0; op < 256; ++op) {
+            base[op] = 1;
+            mem[op] = 0;
+        }
+        for (int op : {0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x36, 0x3E, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0xC6,
+                       0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE, 0xD3, 0xDB, 0xCB}) {
+            base[op] = 2;
+        }
+        for (int op : {0x01, 0x11, 0x21, 0x31, 0x22, 0x2A, 0x32, 0x3A, 0xC2, 0xC3, 0xCA, 0xD2, 0xDA, 0xE2, 0xEA,
+                       0xF2, 0xFA, 0xC4, 0xCC, 0xCD, 0xD4, 0xDC, 0xE4, 0xEC, 0xF4, 0xFC}) {
+            base[op] = 3;
+        }
+        for (int op : {0x34, 0x35, 0x36, 0x46, 0x4E, 0x56, 0x5E, 0x66, 0x6E, 0x7E}) mem[op] = 1;
+        for (int op = 0x70; op <= 0x77; ++op) mem[op] = op != 0x76;
+        for (int op = 0x86; op <= 0xBE; op += 8) mem[op] = 1;
+        base[0xDD] = base[0xED] = base[0xFD] = 0; // prefixes, sized by length()
+    }
+
+    // Length of the instruction at p (n bytes left; never more than n).
+    size_t length(const uint8_t* p, size_t n) const {
+        size_t len = base[p[0]];
+        if (len != 0) return std::min(len, n);
+        if (p[0] == 0xED) {
+            // LD (nnnn),rr / LD rr,(nnnn); the rest of the ED page is 2 bytes.
+            len = n > 1 && (p[1] & 0xC7) == 0x43 ? 4 : 2;
+        } else if (n > 1) {
+            // DD/FD: the indexed form of the next opcode.
+            uint8_t op = p[1];
+            if (op == 0xCB) len = 4;               // DD CB d op
+            else if (base[op] == 0) len = 1;       // another prefix follows: this one does nothing
+            else len = 1 + base[op] + mem[op];
+        } else {
+            len = 1;
+        }
+        return std::min(len, n);
+    }
+};
+
+// The Konami SCC register a bank-switch write to addr maps onto, or 0 if
+// addr isn't one of from's registers.
+uint16_t scc_register(RomMapper from, unsigned addr) {
+    static const uint16_t scc[4] = {0x5000, 0x7000, 0x9000, 0xB000};
+    if (from == RomMapper::Konami && addr >= 0x6000 && addr < 0xC000) return scc[(addr >> 13) - 2];
+    if (from == RomMapper::ASCII8 && addr >= 0x6000 && addr < 0x8000) return scc[(addr >> 11) & 3];
+    return 0;
+}
+
+} // namespace
+
+Status translate_mapper(span<uint8_t> rom, RomMapper from, std::vector<MapperPatch>& log) {
+    if (from != RomMapper::Konami && from != RomMapper::ASCII8) return Status::NotTranslatable;
+    static const Z80Lengths z80;
+    uint8_t* d = rom.data();
+    size_t n = rom.size();
+    auto patch = [&](size_t at) {
+        unsigned addr = d[at] | d[at + 1] << 8;
+        uint16_t to = scc_register(from, addr);
+        if (to == 0 || to == addr) return;
+        d[at] = static_cast<uint8_t>(to);
+        d[at + 1] = static_cast<uint8_t>(to >> 8);
+        log.push_back(MapperPatch{at, static_cast<uint16_t>(addr), to});
+    };
+    for (size_t i = 0, len; i < n; i += len) {
+        len = z80.length(d + i, n - i);
+        if (len < 3) continue;
+        if (d[i] == 0x32) {
+            patch(i + 1); // LD (nnnn),A
+        } else if (d[i] == 0x21 && i + 3 < n && d[i + 3] >= 0x70 && d[i + 3] <= 0x77 && d[i + 3] != 0x76) {
+            patch(i + 1); // LD HL,nnnn; LD (HL),r
+        }
+    }
+    return Status::Ok;
+}
+
+Status type_for_mapper(const MapperGuess& g, size_t rom_bytes, CartType& type) {
+    switch (g.mapper) {
+        case RomMapper::None:
+            if (rom_bytes > 0x10000) return Status::MapperUnknown;
+            type = CartType::Simple64K;
+            return Status::Ok;
+        case RomMapper::KonamiSCC:
+            type = CartType::MegaSCC;
+            return Status::Ok;
+        default:
+            return Status::MapperUnsupported;
+    }
+}
+
+void Sha1::update(const uint8_t* p, size_t n) {
+    total_ += n;
+    if (used_) {
+        size_t k = std::min(n, sizeof(block_) - used_);
+        std::memcpy(block_ + used_, p, k);
+        used_ += k;
+        p += k;
+        n -= k;
+        if (used_ < sizeof(block_)) return;
+        compress(block_);
+        used_ = 0;
+    }
+    for (; n >= 64; p += 64, n -= 64) compress(p);
+    std::memcpy(block_, p, n);
+    used_ = n;
+}
+
+void Sha1::final(uint8_t digest[20]) {
+    uint64_t bits = total_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padlen = (used_ < 56 ? 56 : 120) - used_;
+    for (int k = 0; k < 8; ++k) pad[padlen + k] = static_cast<uint8_t>(bits >> (56 - 8 * k));
+    update(pad, padlen + 8);
+    for (int k = 0; k < 20; ++k) digest[k] = static_cast<uint8_t>(h_[k / 4] >> (24 - 8 * (k % 4)));
+}
+
+std::string Sha1::hex() {
+    uint8_t d[20];
+    final(d);
+    std::string s;
+    for (uint8_t b : d) put_hex_byte(s, b);
+    for (auto& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return s;
+}
+
+void Sha1::compress(const uint8_t* b) {
+    auto rol = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+    uint32_t w[16]; // the message schedule, as a ring of its last 16 words
+    for (int t = 0; t < 16; ++t) {
+        w[t] = (uint32_t(b[4 * t]) << 24) | (uint32_t(b[4 * t + 1]) << 16) | (uint32_t(b[4 * t + 2]) << 8) |
+               uint32_t(b[4 * t + 3]);
+    }
+    auto sched = [&](int t) {
+        if (t < 16) return w[t];
+        w[t & 15] = rol(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+        return w[t & 15];
+    };
+    uint32_t a = h_[0], bb = h_[1], c = h_[2], d = h_[3], e = h_[4];
+    // Five rounds per step: the working variables rotate by renaming instead
+    // of being moved every round.
+    auto step = [&](auto f, uint32_t k, int t) {
+        e += rol(a, 5) + f(bb, c, d) + k + sched(t);
+        bb = rol(bb, 30);
+        d += rol(e, 5) + f(a, bb, c) + k + sched(t + 1);
+        a = rol(a, 30);
+        c += rol(d, 5) + f(e, a, bb) + k + sched(t + 2);
+        e = rol(e, 30);
+        bb += rol(c, 5) + f(d, e, a) + k + sched(t + 3);
+        d = rol(d, 30);
+        a += rol(bb, 5) + f(c, d, e) + k + sched(t + 4);
+        c = rol(c, 30);
+    };
+    auto ch = [](uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+    auto parity = [](uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+    auto maj = [](uint32_t x, uint32_t y, uint32_t z) { return (x & y) | (z & (x | y)); };
+    for (int t = 0; t < 20; t += 5) step(ch, 0x5A827999, t);
+    for (int t = 20; t < 40; t += 5) step(parity, 0x6ED9EBA1, t);
+    for (int t = 40; t < 60; t += 5) step(maj, 0x8F1BBCDC, t);
+    for (int t = 60; t < 80; t += 5) step(parity, 0xCA62C1D6, t);
+    h_[0] += a;
+    h_[1] += bb;
+    h_[2] += c;
+    h_[3] += d;
+    h_[4] += e;
+}
+
+// Blank stretches are skipped 64 bytes at a time.
+std::vector<Range> find_ranges(span<const uint8_t> img, size_t merge_gap) {
+    const uint8_t* p = img.data();
+    size_t n = img.size();
+    std::vector<Range> ranges;
+    size_t i = 0;
+    while (i < n) {
+        while (i + 64 <= n && all_ff(p + i, 64)) i += 64;
+        while (i < n && p[i] == 0xFF) ++i;
+        if (i >= n) break;
+        size_t start = i, last = i;
+        for (; i < n && i - last <= merge_gap; ++i) {
+            if (p[i] != 0xFF) last = i;
+        }
+        ranges.push_back(Range{start, last + 1 - start});
+        i = last + 1;
+    }
+    return ranges;
+}
+
+// Intel HEX: 16-byte data records, a type 04 record whenever the upper 16
+// address bits change, type 01 end of file.
+std::string encode_ihex(span<const uint8_t> img, const std::vector<Range>& ranges) {
+    std::string s;
+    auto record = [&](unsigned type, unsigned addr, const uint8_t* d, unsigned len) {
+        unsigned sum = len + ((addr >> 8) & 0xFF) + (addr & 0xFF) + type;
+        s += ':';
+        put_hex_byte(s, len);
+        put_hex_byte(s, addr >> 8);
+        put_hex_byte(s, addr);
+        put_hex_byte(s, type);
+        for (unsigned k = 0; k < len; ++k) {
+            put_hex_byte(s, d[k]);
+            sum += d[k];
+        }
+        put_hex_byte(s, (0x100 - (sum & 0xFF)) & 0xFF);
+        s += '\n';
+    };
+    size_t upper = 0;
+    for (const auto& r : ranges) {
+        for (size_t a = r.off; a < r.off + r.len;) {
+            if ((a >> 16) != upper) {
+                upper = a >> 16;
+                uint8_t ela[2] = {static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper)};
+                record(0x04, 0, ela, 2);
+            }
+            // Records never cross a 64 KiB boundary.
+            size_t len = std::min<size_t>({16, r.off + r.len - a, 0x10000 - (a & 0xFFFF)});
+            record(0x00, static_cast<unsigned>(a & 0xFFFF), img.data() + a, static_cast<unsigned>(len));
+            a += len;
+        }
+    }
+    record(0x01, 0, nullptr, 0);
+    return s;
+}
+
+// Motorola S-record: S0 header, S2 (24-bit) or, past 16 MiB, S3 (32-bit)
+// data records of 16 bytes, an S5 record count and the matching S8/S7 end.
+std::string encode_srec(span<const uint8_t> img, const std::vector<Range>& ranges) {
+    std::string s;
+    bool wide = img.size() > 0x1000000;
+    auto record = [&](char type, size_t addr, unsigned addr_bytes, const uint8_t* d, unsigned len) {
+        unsigned count = addr_bytes + len + 1;
+        unsigned sum = count;
+        s += 'S';
+        s += type;
+        put_hex_byte(s, count);
+        for (unsigned k = addr_bytes; k-- > 0;) {
+            unsigned b = static_cast<unsigned>(addr >> (8 * k)) & 0xFF;
+            put_hex_byte(s, b);
+            sum += b;
+        }
+        for (unsigned k = 0; k < len; ++k) {
+            put_hex_byte(s, d[k]);
+            sum += d[k];
+        }
+        put_hex_byte(s, ~sum & 0xFF);
+        s += '\n';
+    };
+    static const uint8_t header[] = {'r', 'o', 'm', '2', 'm', 's', 'x'};
+    record('0', 0, 2, header, sizeof(header));
+    size_t records = 0;
+    for (const auto& r : ranges) {
+        for (size_t a = r.off; a < r.off + r.len; a += 16, ++records) {
+            unsigned len = static_cast<unsigned>(std::min<size_t>(16, r.off + r.len - a));
+            record(wide ? '3' : '2', a, wide ? 4 : 3, img.data() + a, len);
+        }
+    }
+    if (records <= 0xFFFF) record('5', records, 2, nullptr, 0);
+    record(wide ? '7' : '8', 0, wide ? 4 : 3, nullptr, 0);
+    return s;
+}
+
+// Range list: "R2MR", u8 version (1), 3 reserved bytes, u32 image size,
+// u32 count, then count times u32 offset + u32 length + data (little-endian).
+std::vector<uint8_t> encode_ranges(span<const uint8_t> img, const std::vector<Range>& ranges) {
+    std::vector<uint8_t> v = {'R', '2', 'M', 'R', 1, 0, 0, 0};
+    put_le32(v, static_cast<uint32_t>(img.size()));
+    put_le32(v, static_cast<uint32_t>(ranges.size()));
+    for (const auto& r : ranges) {
+        put_le32(v, static_cast<uint32_t>(r.off));
+        put_le32(v, static_cast<uint32_t>(r.len));
+        v.insert(v.end(), img.data() + r.off, img.data() + r.off + r.len);
+    }
+    return v;
+}
+
+std::vector<size_t> changed_sectors(span<const uint8_t> img, span<const uint8_t> base) {
+    std::vector<size_t> changed;
+    size_t sectors = std::min(img.size(), base.size()) / SECTOR_SIZE;
+    for (size_t s = 0; s < sectors; ++s) {
+        if (std::memcmp(img.data() + s * SECTOR_SIZE, base.data() + s * SECTOR_SIZE, SECTOR_SIZE) != 0) {
+            changed.push_back(s);
+        }
+    }
+    return changed;
+}
+
+// Sector delta: "R2MD", u8 version (1), 3 reserved bytes, u32 sector size,
+// u32 image size, u32 count, then count times u32 offset + sector data (all
+// little-endian).
+std::vector<uint8_t> encode_delta(span<const uint8_t> img, const std::vector<size_t>& sectors) {
+    std::vector<uint8_t> v = {'R', '2', 'M', 'D', 1, 0, 0, 0};
+    put_le32(v, static_cast<uint32_t>(SECTOR_SIZE));
+    put_le32(v, static_cast<uint32_t>(img.size()));
+    put_le32(v, static_cast<uint32_t>(sectors.size()));
+    for (size_t s : sectors) {
+        const uint8_t* sec = img.data() + s * SECTOR_SIZE;
+        put_le32(v, static_cast<uint32_t>(s * SECTOR_SIZE));
+        v.insert(v.end(), sec, sec + SECTOR_SIZE);
+    }
+    return v;
+}
+
+namespace {
+
+// Length of the common prefix of a and b (n if they are equal).
+size_t common_prefix(const uint8_t* a, const uint8_t* b, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 64 <= n; i += 64) {
+        __m128i v = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))),
+                          _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16)))),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32))),
+                          _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48)))));
+        if (_mm_movemask_epi8(v) != 0xFFFF) break;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        if (x != y) break;
+    }
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Tally one differing stretch of 8 bytes (zero-padded past the data): the
+// flipped bits of data line k are bit k of every byte.
+void tally_word(uint64_t want, uint64_t got, SectorDiff& s, DumpDiff& diff) {
+    constexpr uint64_t lsb = 0x0101010101010101ull;
+    uint64_t rose = ~want & got, fell = want & ~got;
+    uint64_t d = want ^ got;
+    d |= d >> 4;
+    d |= d >> 2;
+    d |= d >> 1;
+    s.bytes += static_cast<size_t>(__builtin_popcountll(d & lsb));
+    s.rose += static_cast<size_t>(__builtin_popcountll(rose));
+    s.fell += static_cast<size_t>(__builtin_popcountll(fell));
+    for (int k = 0; k < 8; ++k) {
+        diff.line_rose[k] += static_cast<size_t>(__builtin_popcountll((rose >> k) & lsb));
+        diff.line_fell[k] += static_cast<size_t>(__builtin_popcountll((fell >> k) & lsb));
+    }
+}
+
+} // namespace
+
+Status diff_dump(span<const uint8_t> img, span<const uint8_t> dump, DumpDiff& diff) {
+    diff = DumpDiff();
+    if (img.size() != dump.size()) return Status::VerifySizeMismatch;
+    const uint8_t* a = img.data();
+    const uint8_t* b = dump.data();
+    for (size_t lo = 0; lo < img.size(); lo += SECTOR_SIZE) {
+        size_t hi = std::min(lo + SECTOR_SIZE, img.size());
+        SectorDiff s;
+        s.sector = lo / SECTOR_SIZE;
+        for (size_t i = lo + common_prefix(a + lo, b + lo, hi - lo); i < hi;) {
+            uint64_t x = 0, y = 0;
+            size_t n = std::min<size_t>(8, hi - i);
+            std::memcpy(&x, a + i, n);
+            std::memcpy(&y, b + i, n);
+            tally_word(x, y, s, diff);
+            i += n;
+            i += common_prefix(a + i, b + i, hi - i);
+        }
+        if (s.bytes == 0) continue;
+        diff.bytes += s.bytes;
+        diff.rose += s.rose;
+        diff.fell += s.fell;
+        diff.sectors.push_back(s);
+    }
+    return Status::Ok;
+}
+
+namespace {
+
+// Two single-bank placements hold the same image bytes: their data, then
+// 0xFF up to the bank end.
+bool same_bank(const Placement& a, const Placement& b) {
+    size_t n = std::min(a.rom_bytes, b.rom_bytes);
+    if (std::memcmp(a.rom, b.rom, n) != 0) return false;
+    const Placement& longer = a.rom_bytes > b.rom_bytes ? a : b;
+    return all_ff(longer.rom + n, longer.rom_bytes - n);
+}
+
+uint32_t bank_key(const Placement& b) {
+    static const std::vector<uint8_t> blank(BANK_SIZE, 0xFF);
+    return crc32(blank.data(), BANK_SIZE - b.rom_bytes, crc32(b.rom, b.rom_bytes));
+}
+
+} // namespace
+
+void dedup_banks(const std::vector<span<const uint8_t>>& roms, std::vector<Placement>& unique,
+                 std::vector<std::vector<size_t>>& maps) {
+    unique.clear();
+    maps.assign(roms.size(), {});
+    std::unordered_multimap<uint32_t, size_t> index; // bank key -> position in unique
+    for (size_t r = 0; r < roms.size(); ++r) {
+        for (size_t off = 0; off < roms[r].size(); off += BANK_SIZE) {
+            Placement b;
+            b.rom = roms[r].data() + off;
+            b.rom_bytes = std::min(BANK_SIZE, roms[r].size() - off);
+            b.in_banks = 1;
+            uint32_t key = bank_key(b);
+            size_t at = unique.size();
+            for (auto [it, end] = index.equal_range(key); it != end; ++it) {
+                if (same_bank(unique[it->second], b)) {
+                    at = it->second;
+                    break;
+                }
+            }
+            if (at == unique.size()) {
+                b.start_bank = at;
+                unique.push_back(b);
+                index.emplace(key, at);
+            }
+            maps[r].push_back(at);
+        }
+    }
+}
+
+// Bank map: "R2MB", u8 version (1), 3 reserved bytes, u32 ROM count, then per
+// ROM a u16 bank count and that many u16 chip banks (all little-endian).
+std::vector<uint8_t> encode_bank_map(const std::vector<std::vector<size_t>>& maps) {
+    std::vector<uint8_t> v = {'R', '2', 'M', 'B', 1, 0, 0, 0};
+    put_le32(v, static_cast<uint32_t>(maps.size()));
+    for (const auto& m : maps) {
+        put_le16(v, static_cast<uint16_t>(m.size()));
+        for (size_t bank : m) put_le16(v, static_cast<uint16_t>(bank));
+    }
+    return v;
+}
+
+namespace {
+
+// The text of the first <tag ...>text</tag> in [from, to), or "" if none.
+// Only the range is searched: a tag a record lacks mustn't cost a scan of
+// the rest of the file.
+std::string element_text(const std::string& xml, size_t from, size_t to, const char* tag) {
+    std::string_view rec = std::string_view(xml).substr(from, to - from);
+    std::string open = std::string("<") + tag;
+    for (size_t p = rec.find(open); p != std::string_view::npos; p = rec.find(open, p + 1)) {
+        size_t text = p + open.size();
+        if (text >= rec.size()) break;
+        char next = rec[text];
+        if (next != '>' && next != ' ' && next != '\t') continue; // <types> is not <type>
+        text = rec.find('>', text);
+        size_t close = rec.find('<', text);
+        if (close == std::string_view::npos) return "";
+        size_t a = text + 1, b = close;
+        while (a < b && std::isspace(static_cast<unsigned char>(rec[a]))) ++a;
+        while (b > a && std::isspace(static_cast<unsigned char>(rec[b - 1]))) --b;
+        return std::string(rec.substr(a, b - a));
+    }
+    return "";
+}
+
+// softwaredb <type> names, as the mappers rom2msx tells apart.
+RomMapper db_mapper(const std::string& type) {
+    if (type == "KonamiSCC" || type == "SCC") return RomMapper::KonamiSCC;
+    if (type == "Konami" || type == "Konami4") return RomMapper::Konami;
+    if (type == "ASCII8") return RomMapper::ASCII8;
+    if (type == "ASCII16") return RomMapper::ASCII16;
+    // Plain ROMs come as Mirrored/Normal plus a variant: Mirrored4000, Normal0000, ...
+    if (type.empty() || type.compare(0, 8, "Mirrored") == 0 || type.compare(0, 6, "Normal") == 0) {
+        return RomMapper::None;
+    }
+    return RomMapper::Other;
+}
+
+bool parse_sha1(const std::string& hex, uint8_t out[20]) {
+    if (hex.size() != 40) return false;
+    for (size_t k = 0; k < 40; ++k) {
+        int c = std::tolower(static_cast<unsigned char>(hex[k]));
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (v < 0) return false;
+        out[k / 2] = static_cast<uint8_t>(k % 2 ? out[k / 2] | v : v << 4);
+    }
+    return true;
+}
+
+} // namespace
+
+std::vector<uint8_t> build_db_index(const std::string& xml) {
+    std::vector<DbRecord> recs;
+    // The next dump of either kind, in file order. Each kind's next tag is
+    // kept and only the one just consumed is looked for again, so the file is
+    // scanned once per kind however the two are interleaved.
+    size_t rom = xml.find("<rom>"), mega = xml.find("<megarom>");
+    for (;;) {
+        size_t p = std::min(rom, mega);
+        if (p == std::string::npos) break;
+        bool is_rom = p == rom;
+        if (is_rom) rom = xml.find("<rom>", p + 1);
+        else mega = xml.find("<megarom>", p + 1);
+        size_t end = xml.find(is_rom ? "</rom>" : "</megarom>", p);
+        if (end == std::string::npos) break;
+        DbRecord r{};
+        if (!parse_sha1(element_text(xml, p, end, "hash"), r.sha1)) continue;
+        r.mapper = static_cast<uint8_t>(db_mapper(element_text(xml, p, end, "type")));
+        r.start_block = 0xFF;
+        std::string start = element_text(xml, p, end, "start");
+        if (!start.empty()) {
+            unsigned long addr = std::strtoul(start.c_str(), nullptr, 0);
+            if (addr < 0x10000 && addr % BANK_SIZE == 0) r.start_block = static_cast<uint8_t>(addr / BANK_SIZE);
+        }
+        recs.push_back(r);
+    }
+    auto less = [](const DbRecord& a, const DbRecord& b) { return std::memcmp(a.sha1, b.sha1, 20) < 0; };
+    std::stable_sort(recs.begin(), recs.end(), less);
+    recs.erase(std::unique(recs.begin(), recs.end(),
+                           [](const DbRecord& a, const DbRecord& b) { return std::memcmp(a.sha1, b.sha1, 20) == 0; }),
+               recs.end());
+
+    std::vector<uint8_t> v = {'R', '2', 'M', 'I', 1, 0, 0, 0};
+    put_le32(v, static_cast<uint32_t>(recs.size()));
+    const uint8_t* raw = reinterpret_cast<const uint8_t*>(recs.data());
+    v.insert(v.end(), raw, raw + recs.size() * sizeof(DbRecord));
+    return v;
+}
+
+namespace {
+
+size_t db_count(span<const uint8_t> index) {
+    const uint8_t* c = index.data() + 8;
+    return c[0] | c[1] << 8 | c[2] << 16 | static_cast<size_t>(c[3]) << 24;
+}
+
+} // namespace
+
+bool db_index_valid(span<const uint8_t> index) {
+    return index.size() >= DB_HEADER_SIZE && std::memcmp(index.data(), "R2MI\x01", 5) == 0 &&
+           index.size() >= DB_HEADER_SIZE + db_count(index) * sizeof(DbRecord);
+}
+
+const DbRecord* db_lookup(span<const uint8_t> index, const uint8_t sha1[20]) {
+    if (!db_index_valid(index)) return nullptr;
+    size_t count = db_count(index);
+    const DbRecord* recs = reinterpret_cast<const DbRecord*>(index.data() + DB_HEADER_SIZE);
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(recs[mid].sha1, sha1, 20);
+        if (cmp == 0) return &recs[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+
+namespace {
+
+// CRC-32 (IEEE 802.3, reflected), sliced by 8: t[k][b] is the CRC of byte b
+// followed by k zero bytes, so eight bytes take eight independent lookups.
+struct Crc32Table {
+    uint32_t t[8][256];
+    Crc32Table() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[0][n] = c;
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            for (int k = 1; k < 8; ++k) t[k][n] = t[0][t[k - 1][n] & 0xFF] ^ (t[k - 1][n] >> 8);
+        }
+    }
+};
+
+const Crc32Table& crc32_table() {
+    static const Crc32Table table;
+    return table;
+}
+
+// A byte step of the (uninverted) CRC register is linear in the register
+// plus a constant for the byte: r' = Z(r) ^ t[b]. A run of 2^k 0xFF bytes is
+// then one affine map r' = M(r) ^ c over GF(2), with M held as the images of
+// the 32 unit vectors; runs[k] is that map, made by squaring runs[k - 1].
+struct FfRuns {
+    struct Affine {
+        uint32_t m[32];
+        uint32_t c;
+    } runs[64];
+
+    static uint32_t apply(const uint32_t* m, uint32_t v) {
+        uint32_t r = 0;
+        for (int i = 0; v; ++i, v >>= 1) {
+            if (v & 1) r ^= m[i];
+        }
+        return r;
+    }
+
+    FfRuns() {
+        const Crc32Table& tab = crc32_table();
+        for (int i = 0; i < 32; ++i) {
+            uint32_t r = 1u << i;
+            runs[0].m[i] = tab.t[0][r & 0xFF] ^ (r >> 8);
+        }
+        runs[0].c = tab.t[0][0xFF];
+        for (int k = 1; k < 64; ++k) {
+            const Affine& h = runs[k - 1];
+            for (int i = 0; i < 32; ++i) runs[k].m[i] = apply(h.m, h.m[i]);
+            runs[k].c = apply(h.m, h.c) ^ h.c;
+        }
+    }
+};
+
+// LSB-first bit reader over a deflate stream. Reading past the end sets err
+// and yields zero bits, so decoding loops end without extra bounds checks.
+struct BitReader {
+    const uint8_t* p;
+    size_t n;
+    size_t pos = 0;
+    uint32_t buf = 0;
+    int cnt = 0;
+    bool err = false;
+
+    void refill() {
+        while (cnt <= 24 && pos < n) {
+            buf |= static_cast<uint32_t>(p[pos++]) << cnt;
+            cnt += 8;
+        }
+    }
+    unsigned bits(int need) {
+        refill();
+        if (cnt < need) {
+            err = true;
+            return 0;
+        }
+        unsigned v = buf & ((1u << need) - 1);
+        buf >>= need;
+        cnt -= need;
+        return v;
+    }
+};
+
+// Canonical Huffman code in the count/symbol form of zlib's puff, plus a
+// 9-bit lookup table that resolves the common short codes in one step.
+struct Huffman {
+    static constexpr int FAST_BITS = 9;
+    short count[16];
+    short symbol[288];
+    uint16_t fast[1 << FAST_BITS]; // symbol << 4 | length, 0 = longer code
+
+    // Returns 0 for a complete code, > 0 for an incomplete one, < 0 if the
+    // lengths are oversubscribed.
+    int build(const short* length, int n) {
+        std::memset(count, 0, sizeof(count));
+        for (int s = 0; s < n; ++s) count[length[s]]++;
+        std::memset(fast, 0, sizeof(fast));
+        if (count[0] == n) return 0;
+        int left = 1;
+        for (int len = 1; len < 16; ++len) {
+            left = (left << 1) - count[len];
+            if (left < 0) return left;
+        }
+        short offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; ++len) offs[len + 1] = static_cast<short>(offs[len] + count[len]);
+        for (int s = 0; s < n; ++s) {
+            if (length[s]) symbol[offs[length[s]]++] = static_cast<short>(s);
+        }
+        // Codes of each length are consecutive, in symbol order; deflate
+        // sends them MSB first, so the table is indexed by the reversed code.
+        int code = 0, index = 0;
+        for (int len = 1; len <= FAST_BITS; ++len) {
+            for (int k = 0; k < count[len]; ++k, ++code, ++index) {
+                unsigned rev = 0;
+                for (int b = 0; b < len; ++b) rev |= ((code >> b) & 1u) << (len - 1 - b);
+                for (unsigned f = rev; f < (1u << FAST_BITS); f += 1u << len) {
+                    fast[f] = static_cast<uint16_t>(symbol[index] << 4 | len);
+                }
+            }
+            code <<= 1;
+        }
+        return left;
+    }
+
+    int decode(BitReader& s) const {
+        s.refill();
+        uint16_t e = fast[s.buf & ((1u << FAST_BITS) - 1)];
+        if (e && (e & 15) <= s.cnt) {
+            s.buf >>= e & 15;
+            s.cnt -= e & 15;
+            return e >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; ++len) {
+            code |= static_cast<int>(s.bits(1));
+            if (s.err) return -1;
+            int c = count[len];
+            if (code - c < first) return symbol[index + (code - first)];
+            index += c;
+            first = (first + c) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+const short LEN_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                            31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const short LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const short DIST_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                             193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const short DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// One compressed block with the given codes, appended at out[*pos].
+bool inflate_codes(BitReader& s, const Huffman& lens, const Huffman& dists, span<uint8_t> out, size_t& pos) {
+    for (;;) {
+        int sym = lens.decode(s);
+        if (sym < 0 || s.err) return false;
+        if (sym < 256) {
+            if (pos >= out.size()) return false;
+            out[pos++] = static_cast<uint8_t>(sym);
+        } else if (sym == 256) {
+            return true;
+        } else {
+            sym -= 257;
+            if (sym >= 29) return false;
+            size_t len = static_cast<size_t>(LEN_BASE[sym]) + s.bits(LEN_EXTRA[sym]);
+            int d = dists.decode(s);
+            if (d < 0 || d >= 30) return false;
+            size_t dist = static_cast<size_t>(DIST_BASE[d]) + s.bits(DIST_EXTRA[d]);
+            if (s.err || dist > pos || len > out.size() - pos) return false;
+            // Byte by byte: the source may overlap the bytes being produced.
+            const uint8_t* from = out.data() + pos - dist;
+            uint8_t* to = out.data() + pos;
+            for (size_t k = 0; k < len; ++k) to[k] = from[k];
+            pos += len;
+        }
+    }
+}
+
+uint16_t le16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | p[1] << 8); }
+uint32_t le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0] | p[1] << 8 | p[2] << 16) | static_cast<uint32_t>(p[3]) << 24;
+}
+
+} // namespace
+
+uint32_t crc32(const uint8_t* p, size_t n, uint32_t crc) {
+    const auto& t = crc32_table().t;
+    crc = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint32_t lo = crc ^ le32(p);
+        uint32_t hi = le32(p + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; n > 0; ++p, --n) crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void ImageChecksum::data(const uint8_t* p, size_t n) {
+    crc_ = rom2msx::crc32(p, n, crc_);
+    sha_.update(p, n);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += p[i];
+    sum_ += sum;
+}
+
+void ImageChecksum::fill(size_t n) {
+    static const FfRuns ff;
+    static const std::vector<uint8_t> blank(4096, 0xFF);
+    uint32_t r = ~crc_;
+    for (int k = 0; k < 64 && (n >> k) != 0; ++k) {
+        if ((n >> k) & 1) r = FfRuns::apply(ff.runs[k].m, r) ^ ff.runs[k].c;
+    }
+    crc_ = ~r;
+    sum_ += 0xFFull * n;
+    for (size_t k; n > 0; n -= k) {
+        k = std::min(n, blank.size());
+        sha_.update(blank.data(), k);
+    }
+}
+
+void checksum_image(ImageChecksum& sums, size_t chip_bytes, const Placement* pl, size_t count) {
+    size_t pos = 0;
+    for (size_t k = 0; k < count; ++k) {
+        size_t lo = pl[k].start_bank * BANK_SIZE;
+        sums.fill(lo - pos);
+        sums.data(pl[k].rom, pl[k].rom_bytes);
+        pos = lo + pl[k].rom_bytes;
+    }
+    sums.fill(chip_bytes - pos);
+}
+
+Status inflate(span<const uint8_t> in, span<uint8_t> out, size_t* produced) {
+    BitReader s{in.data(), in.size()};
+    size_t pos = 0;
+    static const struct Fixed {
+        Huffman lens, dists;
+        Fixed() {
+            short l[288];
+            for (int k = 0; k < 288; ++k) l[k] = k < 144 ? 8 : k < 256 ? 9 : k < 280 ? 7 : 8;
+            lens.build(l, 288);
+            for (int k = 0; k < 30; ++k) l[k] = 5;
+            dists.build(l, 30);
+        }
+    } fixed;
+    Huffman lens, dists;
+    for (bool last = false; !last;) {
+        last = s.bits(1);
+        unsigned type = s.bits(2);
+        if (s.err) return Status::InflateError;
+        if (type == 0) {
+            // Stored: skip to a byte boundary, LEN, ~LEN, then LEN raw bytes.
+            s.bits(s.cnt & 7);
+            unsigned len = s.bits(16);
+            unsigned nlen = s.bits(16);
+            if (s.err || len != (~nlen & 0xFFFF) || len > out.size() - pos) return Status::InflateError;
+            for (; len > 0 && s.cnt > 0; --len) out[pos++] = static_cast<uint8_t>(s.bits(8));
+            if (len > s.n - s.pos) return Status::InflateError;
+            std::memcpy(out.data() + pos, s.p + s.pos, len);
+            pos += len;
+            s.pos += len;
+        } else if (type == 1) {
+            if (!inflate_codes(s, fixed.lens, fixed.dists, out, pos)) return Status::InflateError;
+        } else if (type == 2) {
+            static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+            int nlen = static_cast<int>(s.bits(5)) + 257;
+            int ndist = static_cast<int>(s.bits(5)) + 1;
+            int ncode = static_cast<int>(s.bits(4)) + 4;
+            if (nlen > 286 || ndist > 30) return Status::InflateError;
+            short lengths[320] = {};
+            for (int k = 0; k < ncode; ++k) lengths[order[k]] = static_cast<short>(s.bits(3));
+            Huffman code_lens;
+            if (code_lens.build(lengths, 19) != 0) return Status::InflateError;
+            for (int k = 0; k < nlen + ndist;) {
+                int sym = code_lens.decode(s);
+                if (sym < 0 || s.err) return Status::InflateError;
+                if (sym < 16) {
+                    lengths[k++] = static_cast<short>(sym);
+                    continue;
+                }
+                short repeat = 0;
+                int times;
+                if (sym == 16) {
+                    if (k == 0) return Status::InflateError;
+                    repeat = lengths[k - 1];
+                    times = 3 + static_cast<int>(s.bits(2));
+                } else if (sym == 17) {
+                    times = 3 + static_cast<int>(s.bits(3));
+                } else {
+                    times = 11 + static_cast<int>(s.bits(7));
+                }
+                if (k + times > nlen + ndist) return Status::InflateError;
+                while (times--) lengths[k++] = repeat;
+            }
+            if (lengths[256] == 0) return Status::InflateError;
+            // An incomplete code is only allowed when it has a single symbol.
+            int err = lens.build(lengths, nlen);
+            if (err < 0 || (err > 0 && nlen - lens.count[0] != 1)) return Status::InflateError;
+            err = dists.build(lengths + nlen, ndist);
+            if (err < 0 || (err > 0 && ndist - dists.count[0] != 1)) return Status::InflateError;
+            if (!inflate_codes(s, lens, dists, out, pos)) return Status::InflateError;
+        } else {
+            return Status::InflateError;
+        }
+    }
+    if (produced) *produced = pos;
+    return Status::Ok;
+}
+
+Status zip_list(span<const uint8_t> zip, std::vector<ZipEntry>& entries) {
+    // The end of central directory record is in the last 22 + 65535 bytes
+    // (it may be followed by a comment).
+    const uint8_t* d = zip.data();
+    size_t n = zip.size();
+    if (n < 22) return Status::ArchiveBad;
+    size_t eocd = n - 22;
+    for (size_t stop = n > 22 + 0xFFFF ? n - 22 - 0xFFFF : 0; le32(d + eocd) != 0x06054B50; --eocd) {
+        if (eocd == stop) return Status::ArchiveBad;
+    }
+    size_t count = le16(d + eocd + 10);
+    size_t pos = le32(d + eocd + 16);
+    if (le32(d + eocd + 16) == 0xFFFFFFFFu || le16(d + eocd + 10) == 0xFFFF) return Status::ArchiveUnsupported;
+    entries.clear();
+    for (size_t k = 0; k < count; ++k) {
+        if (pos + 46 > n || le32(d + pos) != 0x02014B50) return Status::ArchiveBad;
+        const uint8_t* h = d + pos;
+        ZipEntry e;
+        e.flags = le16(h + 8);
+        e.method = le16(h + 10);
+        e.crc32 = le32(h + 16);
+        e.comp_size = le32(h + 20);
+        e.size = le32(h + 24);
+        e.local_offset = le32(h + 42);
+        size_t name_len = le16(h + 28);
+        size_t next = pos + 46 + name_len + le16(h + 30) + le16(h + 32);
+        if (next > n) return Status::ArchiveBad;
+        e.name.assign(reinterpret_cast<const char*>(h + 46), name_len);
+        if (!e.name.empty() && e.name.back() != '/') entries.push_back(std::move(e));
+        pos = next;
+    }
+    return Status::Ok;
+}
+
+Status zip_read(span<const uint8_t> zip, const ZipEntry& e, std::vector<uint8_t>& buf, span<const uint8_t>& data) {
+    if ((e.flags & 1) || (e.method != 0 && e.method != 8)) return Status::ArchiveUnsupported;
+    if (e.comp_size == 0xFFFFFFFFu || e.size == 0xFFFFFFFFu) return Status::ArchiveUnsupported;
+    const uint8_t* d = zip.data();
+    size_t lh = e.local_offset;
+    if (lh + 30 > zip.size() || le32(d + lh) != 0x04034B50) return Status::ArchiveBad;
+    size_t off = lh + 30 + le16(d + lh + 26) + le16(d + lh + 28);
+    if (off > zip.size() || e.comp_size > zip.size() - off) return Status::ArchiveBad;
+    span<const uint8_t> raw(d + off, e.comp_size);
+    if (e.method == 0) {
+        if (e.size != e.comp_size) return Status::ArchiveBad;
+        data = raw;
+    } else {
+        // Deflate can't expand beyond ~1032:1; refuse to allocate for lies.
+        if (e.size / 1032 > e.comp_size + 1) return Status::ArchiveBad;
+        buf.resize(e.size);
+        size_t produced = 0;
+        Status s = inflate(raw, buf, &produced);
+        if (s != Status::Ok) return s;
+        if (produced != e.size) return Status::InflateError;
+        data = span<const uint8_t>(buf.data(), buf.size());
+    }
+    if (crc32(data.data(), data.size()) != e.crc32) return Status::ArchiveCrcMismatch;
+    return Status::Ok;
+}
+
+} // namespace rom2msx
@@ -6,12 +6,32 @@
 // Output is a binary image you can program directly to a flash chip.
 // Default chip: SST39SF010 (128 KiB).
 //
-// Build: g++ -O2 -std=c++17 -o rom2msx rom2msx.cpp
+// Build: g++ -O2 -std=c++17 -pthread -o rom2msx rom2msx.cpp rom2msx_io.cpp librom2msx.cpp (or make)
+// The layout/verify core lives in librom2msx (rom2msx.hpp) and the file I/O
+// in rom2msx_io.hpp; this file is the command-line tool around them.
 //
 // Usage:
-//   rom2msx input.rom output.bin [--chip 64|128|256|512]
-//                               [--type mega|rc755|s64k]
+//   rom2msx input.rom output.bin [--chip 64|128|...|8192|64,128,...|all]
+//                               [--type mega|rc755|s64k|auto]
 //                               [--addr 0..7]        (only for --type s64k)
+//                               [--verify[=mapped]] [--base previous.bin]
+//                               [--format bin|ihex|srec|ranges] [--cache dir]
+//                               [--db index.r2mi]    (with --type auto)
+//                               [--checksum] [--translate]
+//                               [--watch]            (rebuild on every change)
+//                               [--sync 1]           (flush before replacing)
+//   ("-" as input.rom/output.bin streams from stdin / to stdout; input.rom
+//    may also be a zip member, "archive.zip#path/in/archive.rom")
+//   rom2msx --batch manifest.txt|dir|archive.zip [--jobs N] [--queue-depth N]
+//                   [--out-dir dir] [--sync N] [options]
+//   (either form: [--stats[=json]] for per-phase timings and byte counters,
+//    [--burn devices.txt [--burn-retries N]] to program the images)
+//   rom2msx --pack output.bin a.rom b.rom[@addr] ... [--dedup] [--sync 1] [options]
+//   rom2msx --plan a.rom b.rom ...|--batch source [options]  (dry run, JSON)
+//   rom2msx input.rom --verify-dump readback.bin [options]  (check a chip)
+//   rom2msx --audit dir [--jobs N] [options]      (check existing images)
+//   rom2msx --build-db softwaredb.xml index.r2mi   (for --type auto --db)
+//   rom2msx --serve socket_path|[host]:port [--jobs N] [options]
 //
 // Mapping rules (mirrors wrtsst logic):
 // - MegaSCC: start bank = 0, 8 KiB banks written sequentially.
@@ -21,202 +41,3170 @@
 //     * If --addr is given (0..7): start bank = addr, but must fit within 8 banks
 //       (i.e., addr + ceil(size/8 KiB) <= 8).
 //     * Only the first 64 KiB window is used; rest of chip remains 0xFF.
+// - auto: the ROM is scanned for LD (nnnn),A writes to bank-switch addresses;
+//   Konami SCC ROMs become MegaSCC, plain ROMs (<= 64 KiB) Simple64K. Konami,
+//   ASCII8 and ASCII16 ROMs are refused, as no supported cart switches that way
+//   (unless --translate rewrites Konami and ASCII8 ones, see below).
+//   With --db index.r2mi the ROM's SHA-1 is looked up first; a softwaredb
+//   record overrides the scan and its start address sets the s64k block.
 //
 // General rules:
 // - Bank size = 8 KiB.
 // - Input is padded up to next 8 KiB with 0xFF if needed.
-// - Output is sized to the selected chip (64/128/256/512 KiB), filled with 0xFF,
-//   then banks are placed per mapping.
+// - Output is sized to the selected chip (64 KiB to 8 MiB): banks are placed
+//   per mapping and only the gaps around them are filled with 0xFF. Raw
+//   images are written with writev() from the ROM bytes and a shared blank
+//   buffer; with --verify=mapped, chips above 512 KiB are rendered in 512 KiB
+//   windows, so no chip-sized buffer is ever filled.
+// - Every output is written under a hidden name next to its target and
+//   renamed over it once complete (and verified), so an interrupted run
+//   never leaves a torn image behind. --sync flushes it to disk first.
+//
+// Mapper translation (--translate):
+// - Konami and ASCII8 ROMs (per --db or the scan) get their bank-switch
+//   writes rewritten to the Konami SCC registers and become MegaSCC images;
+//   the rewritten writes are listed in <output>.patches. Both mappers switch
+//   8 KiB banks, so only the register addresses change. ASCII16 can't be
+//   translated this way.
+//
+// Several chips (--chip 64,128,256,512 or --chip all):
+// - The ROM is read and planned once and an image is written for every size,
+//   named <output>-<size>k.<ext>; sizes the ROM doesn't fit are skipped with
+//   a note. Not available with "-", --base, --pack or --serve.
+//
+// Output formats (--format):
+// - bin: the full chip image (default).
+// - ihex, srec, ranges: only the non-0xFF ranges with their chip addresses,
+//   as Intel HEX, Motorola S-record or a binary range list, for programmers
+//   that leave erased bytes alone.
+//
+// Sector delta (--base previous.bin):
+// - The new image is compared with the previously burned one in 4 KiB sectors
+//   (the SST39SF0x0 erase unit); the changed sectors are listed in
+//   <output>.sectors and their new contents stored in <output>.delta.
+//
+// Checksums (--checksum):
+// - The CRC-32, SHA-1 and 16-bit additive sum of the output image are added
+//   to the report line (and --stats). They are taken while the banks are
+//   placed, with the 0xFF fill accounted for without reading it, so the image
+//   is not read again for them.
+//
+// Conversion cache (--cache dir):
+// - Finished images are stored under the SHA-1 of the ROM plus mapper, chip
+//   size, start bank and format. A later conversion with the same key clones
+//   the stored image (reflink, else copy; never a hard link, which would
+//   share the entry with the output) instead of converting again, once the
+//   clone matches the size and CRC-32 recorded with the entry.
+//
+// Batch mode:
+// - A manifest has one conversion per line: "input output [options]", where
+//   options are the same --type/--chip/--addr/--verify flags as on the command
+//   line and default to the ones given alongside --batch. Blank lines and lines
+//   starting with '#' are ignored; paths containing spaces can be "quoted".
+// - A directory converts every *.rom/*.mx1/*.mx2 file in it to <name>.bin, next
+//   to the input or into --out-dir; a zip archive does the same for its members,
+//   which are decompressed in memory without extracting anything.
+// - Conversions run on --jobs worker threads (default: all cores); the per-job
+//   report lines and a summary are printed in manifest order at the end.
+// - Inputs are read up to --queue-depth jobs (default 8) ahead of the workers,
+//   through io_uring where available and reader threads otherwise, so input
+//   latency overlaps with placing and writing the jobs before them.
+// - --sync N commits the outputs durably N jobs at a time: one syncfs() for
+//   the group, the renames, and one fsync() per output directory. A job's
+//   side files (.sectors, .delta, .patches, the {sectors} list) are in its
+//   group; a failed rename fails only that job, naming what was replaced.
+//
+// Watch mode (--watch):
+// - After the first conversion rom2msx stays running and converts again each
+//   time the input is rewritten (inotify on Linux, kqueue on macOS/BSD, else
+//   polling), with the process, its buffers and the --db mapping kept warm.
+//   With --base pointing at the output, every rebuild writes the sector delta
+//   against the previous one; --checksum and --burn apply to each rebuild.
+// - A rebuild whose ROM kept its size only patches the banks that changed
+//   into a staged clone of the previous output (WatchImage).
+//
+// Burning (--burn devices.txt):
+// - The devices file has one programmer per line, "name command...", where
+//   the command (run by the shell) may use {image}, {device} and {sectors}
+//   (a list of the image's non-blank sectors, <image>.program, for flashers
+//   that program sector by sector). Images are burned as their conversions
+//   finish, one per programmer at a time; a failed burn is retried
+//   --burn-retries times (default 1) and then handed to another programmer,
+//   and a programmer that gives up on two images in a row is retired.
+//
+// Pack mode:
+// - Several ROMs share one chip image. MegaSCC/RC755 ROMs each start on bank 0
+//   of a block sized (and aligned) to the ROM rounded up to a power of two;
+//   the largest go first. Simple64K ROMs get one 64 KiB window each, in the
+//   order given, placed inside it by the usual rules ("rom@N" = --addr N).
+// - A placement table (start bank, banks, byte offset per ROM) is printed.
+// - --dedup (MegaSCC/RC755) stores every distinct 8 KiB bank once instead and
+//   writes <output>.banks, the bank map of every ROM for a menu loader.
+//
+// Placement plan (--plan):
+// - Nothing is converted: for every input (or --batch job) a JSON line gives
+//   the mapper's layout rules (window, start bank alignment, whether --addr
+//   applies) and, per --chip size, the placement (banks, start bank,
+//   padding), the used and erased sectors of the usual part for that size
+//   and estimated erase and programming times, or why the ROM doesn't fit.
+//   Only the file size is read unless --type auto or --translate need the
+//   ROM to find its mapper.
+//
+// Readback check (--verify-dump readback.bin):
+// - The image is built in memory and compared with a dump read back from the
+//   programmed chip; every 4 KiB sector that differs is listed with its bit
+//   flips (1 read where 0 was written, and 0 where 1 was), and the flips are
+//   counted per data line. No output file is written.
+//
+// Audit mode (--audit dir):
+// - Every *.rom/*.mx1/*.mx2 file in the tree is paired with the <name>.bin
+//   next to it, and the image is checked by the --verify rules against the
+//   ROM as --type/--addr/--translate would place it on a chip of the image's
+//   size. Nothing is converted. The pairs are spread over --jobs threads and
+//   the images that fail (missing, wrong size, mismatched bank, non-0xFF
+//   outside the banks) are listed as a table.
 //
 // License: MIT (to align with upstream's permissive license intention).
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <memory>
+
+#include "rom2msx.hpp"
+#include "rom2msx_io.hpp"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h> // FICLONE
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define ROM2MSX_KQUEUE 1
+#include <sys/event.h>
+#endif
+
+using rom2msx::BANK_SIZE;
+using rom2msx::CartType;
+using rom2msx::Placement;
+using rom2msx::SECTOR_SIZE;
+using rom2msx::Status;
+using rom2msx::all_ff;
+using rom2msx::span;
+using rom2msx::type_name;
+using rom2msx::io::Clock;
+using rom2msx::io::InputFile;
+using rom2msx::io::OutputFile;
+using rom2msx::io::Staged;
+using rom2msx::io::StagedFile;
+using rom2msx::io::Stats;
+using rom2msx::io::Stopwatch;
+using rom2msx::io::WINDOW_BYTES;
+using rom2msx::io::commit_job;
+using rom2msx::io::commit_staged;
+using rom2msx::io::discard_staged;
+using rom2msx::io::ok;
+using rom2msx::io::put_file;
+using rom2msx::io::read_file;
+using rom2msx::io::verified;
+using rom2msx::io::verify_file;
+using rom2msx::io::verify_image;
+using rom2msx::io::write_file;
+using rom2msx::io::write_windows;
+#ifndef _WIN32
+using rom2msx::io::write_spans;
+#endif
+#ifdef ROM2MSX_IO_URING
+using rom2msx::io::Ring;
+#endif
 
 static void die(const std::string& msg) {
     std::cerr << "Error: " << msg << std::endl;
     std::exit(1);
 }
 
-static std::vector<uint8_t> read_file(const std::string& path) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f) die("Cannot open input file: " + path);
-    f.seekg(0, std::ios::end);
-    std::streamoff len = f.tellg();
-    if (len < 0) die("tellg failed for input file");
-    f.seekg(0, std::ios::beg);
-    std::vector<uint8_t> buf(static_cast<size_t>(len));
-    if (len > 0) {
-        f.read(reinterpret_cast<char*>(buf.data()), len);
-        if (!f) die("Failed to read input file fully");
+// --verify reads the finished file back through a fresh read-only mapping;
+// --verify=mapped checks the output pages in place before they are committed.
+enum class Verify { None, Readback, Mapped };
+
+// Output encodings: the raw chip image, or only its non-0xFF ranges.
+enum class Format { Bin, IHex, SRec, Ranges };
+
+// Everything one conversion is told on the command line (or a manifest
+// line): the library's layout options plus what to do with the image.
+struct JobOptions : rom2msx::Options {
+    bool auto_type = false; // --type auto: type is picked per ROM (resolve_type)
+    std::string db_path;    // --db: softwaredb index consulted by --type auto
+    Verify verify = Verify::None;
+    std::string base_path; // --base: previously burned image to diff against
+    Format format = Format::Bin;
+    std::string cache_dir; // --cache: content-addressed store of finished images
+    bool checksums = false; // --checksum: CRC-32, SHA-1 and sum16 of the image
+    bool translate = false; // --translate: Konami/ASCII8 bank switching rewritten for MegaSCC
+    std::vector<int> chip_list; // --chip a,b,... / all: one image per size (chip_kib is the largest)
+
+    // Raw images are written straight from the ROM bytes (write_spans) unless
+    // something has to see the image in memory first: a sector delta, or
+    // --verify=mapped.
+    bool vectored() const {
+#ifndef _WIN32
+        return format == Format::Bin && base_path.empty() && verify != Verify::Mapped;
+#else
+        return false;
+#endif
     }
-    return buf;
+
+    // Otherwise those of the multi-megabyte parts are written window by window
+    // (write_windows) unless a sector delta needs the whole image at once.
+    bool chunked() const { return format == Format::Bin && base_path.empty() && chip_bytes() > WINDOW_BYTES; }
+
+    // Sparse formats are encoded from memory, so they have no file to map
+    // back; --verify then checks the image just before it is encoded.
+    bool verify_in_memory() const {
+        return verify == Verify::Mapped || (verify == Verify::Readback && format != Format::Bin);
+    }
+    bool verify_readback() const { return verify == Verify::Readback && format == Format::Bin; }
+};
+
+struct Job {
+    std::string in_path;
+    std::string out_path;
+    JobOptions opt;
+};
+
+// Parse the conversion option at args[i] (advancing i past its value).
+// Returns false with err set on a bad value or an unknown option.
+static bool parse_option(const std::vector<std::string>& args, size_t& i, JobOptions& opt, std::string& err) {
+    const std::string& o = args[i];
+    if (o == "--chip") {
+        if (i + 1 >= args.size()) { err = "--chip requires a value"; return false; }
+        const std::string& v = args[++i];
+        std::vector<int> sizes;
+        if (v == "all") {
+            for (int kib = 64; kib <= 8192; kib *= 2) sizes.push_back(kib);
+        } else {
+            for (size_t at = 0; at <= v.size();) {
+                size_t comma = std::min(v.find(',', at), v.size());
+                sizes.push_back(std::atoi(v.substr(at, comma - at).c_str()));
+                at = comma + 1;
+            }
+        }
+        for (int kib : sizes) {
+            if (!rom2msx::valid_chip_kib(kib)) {
+                err = "Unsupported --chip value (use 64, 128, 256, 512, 1024, 2048, 4096, or 8192, a list or all)";
+                return false;
+            }
+        }
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+        opt.chip_kib = sizes.back();
+        opt.chip_list.clear();
+        if (sizes.size() > 1) opt.chip_list = sizes;
+    } else if (o == "--type") {
+        if (i + 1 >= args.size()) { err = "--type requires a value"; return false; }
+        const std::string& v = args[++i];
+        opt.auto_type = false;
+        if (v == "mega" || v == "scc" || v == "megascc") opt.type = CartType::MegaSCC;
+        else if (v == "rc755") opt.type = CartType::RC755;
+        else if (v == "s64k" || v == "simple64k") opt.type = CartType::Simple64K;
+        else if (v == "auto") opt.auto_type = true;
+        else { err = "Unknown --type value (use mega|rc755|s64k|auto)"; return false; }
+    } else if (o == "--addr") {
+        if (i + 1 >= args.size()) { err = "--addr requires a value 0..7"; return false; }
+        opt.s64k_addr = std::atoi(args[++i].c_str());
+        if (opt.s64k_addr < 0 || opt.s64k_addr > 7) { err = "--addr must be 0..7"; return false; }
+    } else if (o == "--verify" || o == "--verify=readback") {
+        opt.verify = Verify::Readback;
+    } else if (o == "--verify=mapped") {
+        opt.verify = Verify::Mapped;
+    } else if (o == "--format") {
+        if (i + 1 >= args.size()) { err = "--format requires a value"; return false; }
+        const std::string& v = args[++i];
+        if (v == "bin") opt.format = Format::Bin;
+        else if (v == "ihex" || v == "hex") opt.format = Format::IHex;
+        else if (v == "srec" || v == "s19" || v == "s28") opt.format = Format::SRec;
+        else if (v == "ranges") opt.format = Format::Ranges;
+        else { err = "Unknown --format value (use bin|ihex|srec|ranges)"; return false; }
+    } else if (o == "--checksum") {
+        opt.checksums = true;
+    } else if (o == "--translate") {
+        opt.translate = true;
+    } else if (o == "--cache") {
+        if (i + 1 >= args.size()) { err = "--cache requires a directory"; return false; }
+        opt.cache_dir = args[++i];
+    } else if (o == "--db") {
+        if (i + 1 >= args.size()) { err = "--db requires an index file (see --build-db)"; return false; }
+        opt.db_path = args[++i];
+    } else if (o == "--base") {
+        if (i + 1 >= args.size()) { err = "--base requires a file"; return false; }
+        opt.base_path = args[++i];
+    } else {
+        err = std::string("Unknown option: ") + o;
+        return false;
+    }
+    return true;
 }
 
-static void write_file(const std::string& path, const std::vector<uint8_t>& buf) {
-    std::ofstream f(path, std::ios::binary | std::ios::trunc);
-    if (!f) die("Cannot open output file: " + path);
-    f.write(reinterpret_cast<const char*>(buf.data()), buf.size());
-    if (!f) die("Failed to write output file");
+static const char* format_extension(Format format) {
+    switch (format) {
+        case Format::Bin:    return ".bin";
+        case Format::IHex:   return ".hex";
+        case Format::SRec:   return ".srec";
+        case Format::Ranges: return ".ranges";
+    }
+    return ".bin";
 }
 
-enum class CartType { MegaSCC, RC755, Simple64K };
+static bool is_rom_name(const std::filesystem::path& p) {
+    std::string ext = p.extension().string();
+    for (auto& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext == ".rom" || ext == ".mx1" || ext == ".mx2";
+}
 
-int main(int argc, char** argv) {
-    bool verify = false;
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " input.rom output.bin [--chip 64|128|256|512] [--type mega|rc755|s64k] [--addr 0..7]\n";
-        std::cerr << "Defaults: --chip 128 (SST39SF010), --type mega\n";
-        return 1;
+// Archive inputs are named "archive.zip#member/path.rom", or just
+// "archive.zip" when the archive holds a single ROM. Returns false for
+// anything else.
+static bool split_archive_path(const std::string& path, std::string& archive, std::string& member) {
+    std::string lower = path;
+    for (auto& c : lower) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    size_t hash = lower.find(".zip#");
+    if (hash != std::string::npos) {
+        archive = path.substr(0, hash + 4);
+        member = path.substr(hash + 5);
+        return true;
     }
+    if (lower.size() > 4 && lower.compare(lower.size() - 4, 4, ".zip") == 0) {
+        archive = path;
+        member.clear();
+        return true;
+    }
+    return false;
+}
 
-    std::string in_path = argv[1];
-    std::string out_path = argv[2];
-    int chip_kib = 128; // default SST39SF010
-    CartType type = CartType::MegaSCC;
-    int s64k_addr = -1; // optional start block
+// A mapped zip archive with its central directory read.
+struct Archive {
+    InputFile file;
+    std::vector<rom2msx::ZipEntry> entries;
+    std::map<std::string, size_t> by_name;
+    std::filesystem::file_time_type mtime;
+    uintmax_t size = 0;
 
-    // Parse options
-    for (int i = 3; i < argc; ++i) {
-        std::string opt = argv[i];
-        if (opt == "--chip") {
-            if (i + 1 >= argc) die("--chip requires a value");
-            chip_kib = std::atoi(argv[++i]);
-            if (!(chip_kib == 64 || chip_kib == 128 || chip_kib == 256 || chip_kib == 512)) {
-                die("Unsupported --chip value (use 64, 128, 256, or 512)");
-            }
-        } else if (opt == "--type") {
-            if (i + 1 >= argc) die("--type requires a value");
-            std::string v = argv[++i];
-            if (v == "mega" || v == "scc" || v == "megascc") type = CartType::MegaSCC;
-            else if (v == "rc755") type = CartType::RC755;
-            else if (v == "s64k" || v == "simple64k") type = CartType::Simple64K;
-            else die("Unknown --type value (use mega|rc755|s64k)");
-        } else if (opt == "--addr") {
-            if (i + 1 >= argc) die("--addr requires a value 0..7");
-            s64k_addr = std::atoi(argv[++i]);
-            if (s64k_addr < 0 || s64k_addr > 7) die("--addr must be 0..7");
-        } else if (opt == "--verify") {
-            verify = true;
+    span<const uint8_t> bytes() const { return span<const uint8_t>(file.data(), file.size()); }
+};
+
+// Archives are opened once per process and shared by every job reading from
+// them, so a batch over a collection maps it and parses its directory once.
+// An archive that changed on disk since is opened again.
+static std::shared_ptr<const Archive> open_archive(const std::string& path, std::string& err) {
+    namespace fs = std::filesystem;
+    static std::mutex mu;
+    static std::map<std::string, std::shared_ptr<const Archive>> archives;
+    std::error_code ec;
+    auto mtime = fs::last_write_time(path, ec);
+    uintmax_t size = fs::file_size(path, ec);
+    if (ec) { err = "Cannot open input file: " + path; return nullptr; }
+    std::lock_guard<std::mutex> lock(mu);
+    std::shared_ptr<const Archive>& cached = archives[path];
+    if (cached && cached->mtime == mtime && cached->size == size) return cached;
+    auto a = std::make_shared<Archive>();
+    a->mtime = mtime;
+    a->size = size;
+    if (!a->file.open(path, err)) return nullptr;
+    if (!ok(rom2msx::zip_list(a->bytes(), a->entries), err)) {
+        err = path + ": " + err;
+        return nullptr;
+    }
+    for (size_t k = 0; k < a->entries.size(); ++k) a->by_name.emplace(a->entries[k].name, k);
+    cached = a;
+    return cached;
+}
+
+// Memory a batch worker reuses from job to job. The buffers only ever grow,
+// so once they have held the largest input and image of a batch, conversions
+// make no more heap allocations for their data.
+struct Arena {
+    std::vector<uint8_t> rom;  // the input, when it is read rather than mapped
+    std::vector<uint8_t> copy; // --translate's patched ROM
+    std::vector<uint8_t> base; // --base image
+    std::vector<uint8_t> img;  // images that are encoded or can't be mapped
+    std::vector<uint8_t> win;  // write_windows' window
+};
+
+// A ROM to convert: a plain file (see InputFile) or a zip member. Stored
+// members are used in place in the archive's mapping, deflated ones are
+// inflated straight into buf; nothing is extracted to disk.
+class RomInput {
+public:
+    explicit RomInput(std::vector<uint8_t>& buf) : buf_(buf) {}
+
+    bool open(const std::string& path, std::string& err) {
+        std::string zip, member;
+        if (!split_archive_path(path, zip, member)) {
+            if (!file_.open(path, err)) return false;
+            data_ = span<const uint8_t>(file_.data(), file_.size());
+            return true;
+        }
+        archive_ = open_archive(zip, err);
+        if (!archive_) return false;
+        const rom2msx::ZipEntry* e = nullptr;
+        if (!member.empty()) {
+            auto it = archive_->by_name.find(member);
+            if (it == archive_->by_name.end()) { err = "No " + member + " in " + zip; return false; }
+            e = &archive_->entries[it->second];
         } else {
-            die(std::string("Unknown option: ") + opt);
+            // Without a member name the archive must hold exactly one ROM.
+            size_t roms = 0;
+            for (const auto& x : archive_->entries) {
+                if (is_rom_name(x.name)) e = &x, ++roms;
+            }
+            if (roms == 0 && archive_->entries.size() == 1) e = &archive_->entries[0], roms = 1;
+            if (roms != 1) {
+                err = zip + " holds " + std::to_string(roms) + " ROMs; name one as " + zip + "#member";
+                return false;
+            }
+        }
+        if (!ok(rom2msx::zip_read(archive_->bytes(), *e, buf_, data_), err)) {
+            err = zip + "#" + e->name + ": " + err;
+            return false;
         }
+        return true;
+    }
+
+    // Use a ROM that is already in memory (and outlives this input).
+    void use(span<const uint8_t> rom) { data_ = rom; }
+
+    const uint8_t* data() const { return data_.data(); }
+    size_t size() const { return data_.size(); }
+
+private:
+    InputFile file_;
+    std::shared_ptr<const Archive> archive_;
+    std::vector<uint8_t>& buf_;
+    span<const uint8_t> data_;
+};
+
+// Load the --base image. It is read into memory rather than mapped because
+// it is often the very file the new image is about to replace.
+static bool load_base(const JobOptions& opt, size_t chip_bytes, std::vector<uint8_t>& base, std::string& err) {
+    if (opt.base_path.empty()) return true;
+    if (!read_file(opt.base_path, base, err)) {
+        err = "--base: " + err;
+        return false;
+    }
+    if (base.size() != chip_bytes) {
+        err = "--base: " + opt.base_path + " is " + std::to_string(base.size()) +
+              " bytes, expected the chip size (" + std::to_string(chip_bytes) + ")";
+        return false;
+    }
+    return true;
+}
+
+// Compare the new image against the previously burned one sector by sector
+// and write the sectors that changed next to out_path:
+//   <out>.sectors  text list "index offset program|erase", one per sector
+//                  ("erase" = the new sector is blank, erasing is enough)
+//   <out>.delta    the sectors' new contents (rom2msx::encode_delta)
+// summary gets the report fragment for the caller. With staged, both files
+// join the image's group commit.
+static bool write_delta(const uint8_t* img, size_t img_bytes, const std::vector<uint8_t>& base,
+                        const std::string& out_path, std::string& summary, std::string& err,
+                        std::vector<Staged>* staged) {
+    span<const uint8_t> image(img, img_bytes);
+    auto changed = rom2msx::changed_sectors(image, base);
+    std::string list = "# rom2msx sector delta: index offset action (sector size " +
+                       std::to_string(SECTOR_SIZE) + ")\n";
+    for (size_t s : changed) {
+        char line[64];
+        bool blank = all_ff(img + s * SECTOR_SIZE, SECTOR_SIZE);
+        std::snprintf(line, sizeof(line), "%zu 0x%06zX %s\n", s, s * SECTOR_SIZE, blank ? "erase" : "program");
+        list += line;
     }
+    auto delta = rom2msx::encode_delta(image, changed);
+    if (!write_file(out_path + ".sectors", reinterpret_cast<const uint8_t*>(list.data()), list.size(), err,
+                    staged) ||
+        !write_file(out_path + ".delta", delta.data(), delta.size(), err, staged)) {
+        return false;
+    }
+    summary = "; delta: " + std::to_string(changed.size()) + " of " + std::to_string(img_bytes / SECTOR_SIZE) +
+              " sectors changed";
+    return true;
+}
+
+// Write the finished image in the requested format.
+static bool commit_image(OutputFile& out, Format format, std::string& err) {
+    if (format == Format::Bin) return out.commit(err);
+    span<const uint8_t> img(out.data(), out.size());
+    auto ranges = rom2msx::find_ranges(img, 16);
+    if (format == Format::Ranges) {
+        auto v = rom2msx::encode_ranges(img, ranges);
+        return put_file(out.path(), v.data(), v.size(), err);
+    }
+    std::string text = format == Format::IHex ? rom2msx::encode_ihex(img, ranges) : rom2msx::encode_srec(img, ranges);
+    return put_file(out.path(), reinterpret_cast<const uint8_t*>(text.data()), text.size(), err);
+}
+
+// Make dst a copy of the regular file src: a reflink where the file system
+// supports it, else a plain copy (never a link: dst is a file of its own).
+// Returns false if src doesn't exist or dst can't be replaced.
+static bool clone_file(const std::string& src, const std::string& dst) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_regular_file(src, ec)) return false;
+    auto st = fs::symlink_status(dst, ec);
+    if (fs::exists(st) && !fs::is_regular_file(st)) return false;
+    fs::remove(dst, ec);
+#ifdef __linux__
+    int sfd = ::open(src.c_str(), O_RDONLY);
+    if (sfd >= 0) {
+        int dfd = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        bool cloned = dfd >= 0 && ioctl(dfd, FICLONE, sfd) == 0;
+        if (dfd >= 0) ::close(dfd);
+        ::close(sfd);
+        if (cloned) return true;
+        fs::remove(dst, ec);
+    }
+#endif
+    return fs::copy_file(src, dst, ec);
+}
 
-    constexpr size_t BANK_SIZE = 0x2000; // 8 KiB
-    size_t chip_bytes = static_cast<size_t>(chip_kib) * 1024ULL;
+// Cache entry for a conversion: the ROM's SHA-1 plus everything else the
+// output bytes depend on (mapper, chip size, resolved start bank, format).
+static std::string cache_entry(const JobOptions& opt, const Placement& p) {
+    rom2msx::Sha1 h;
+    h.update(p.rom, p.rom_bytes);
+    std::string name = h.hex() + "-" + type_name(opt.type) + "-" + std::to_string(opt.chip_kib) + "k-b" +
+                       std::to_string(p.start_bank) + format_extension(opt.format);
+    return (std::filesystem::path(opt.cache_dir) / name).string();
+}
+
+// The "<size> <crc32>" record kept next to a cache entry (as <entry>.crc),
+// which a hit has to match.
+static std::string cache_record(const InputFile& f) {
+    char line[48];
+    std::snprintf(line, sizeof(line), "%zu %08x\n", f.size(), rom2msx::crc32(f.data(), f.size()));
+    return line;
+}
+
+// Add a freshly written output (at src) to the cache. The entry is always a
+// reflink or a copy, never a link to the output, and appears atomically via
+// rename, or with the output's group when staged is given.
+static bool store_in_cache(const std::string& src, const std::string& entry, std::vector<Staged>* staged) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(entry).parent_path(), ec);
+    StagedFile f(entry);
+    std::string err;
+    InputFile copy;
+    if (!clone_file(src, f.tmp()) || !copy.open(f.tmp(), err)) return false;
+    std::string record = cache_record(copy);
+    return write_file(entry + ".crc", reinterpret_cast<const uint8_t*>(record.data()), record.size(), err,
+                      staged) &&
+           f.publish(staged, err);
+}
 
-    auto rom = read_file(in_path);
+// Clone a cache entry to dst if it is intact: its size (for a raw image, the
+// chip's) and CRC-32 match its record. A damaged or unrecorded entry is
+// evicted, and the caller converts as on a miss.
+static bool clone_cached(const std::string& entry, const std::string& dst, size_t raw_bytes) {
+    if (!clone_file(entry, dst)) return false;
+    std::vector<uint8_t> record;
+    InputFile copy;
+    std::string err;
+    if (read_file(entry + ".crc", record, err) && copy.open(dst, err) && (!raw_bytes || copy.size() == raw_bytes) &&
+        std::string(record.begin(), record.end()) == cache_record(copy)) {
+        return true;
+    }
+    std::error_code ec;
+    std::filesystem::remove(dst, ec);
+    std::filesystem::remove(entry, ec);
+    std::filesystem::remove(entry + ".crc", ec);
+    return false;
+}
 
-    // Pad input ROM up to multiple of 8 KiB with 0xFF.
-    if (rom.size() % BANK_SIZE != 0) {
-        size_t padded = ((rom.size() + BANK_SIZE - 1) / BANK_SIZE) * BANK_SIZE;
-        rom.resize(padded, 0xFF);
+// --db indexes are mapped once and shared by every job of the process. Only
+// indexes that opened are kept; a bad path is tried again next time.
+static const InputFile* open_db(const std::string& path, std::string& err) {
+    static std::mutex mu;
+    static std::map<std::string, std::unique_ptr<InputFile>> dbs;
+    std::lock_guard<std::mutex> lock(mu);
+    auto it = dbs.find(path);
+    if (it != dbs.end()) return it->second.get();
+    auto f = std::make_unique<InputFile>();
+    if (!f->open(path, err)) { err = "--db: " + err; return nullptr; }
+    if (!rom2msx::db_index_valid(span<const uint8_t>(f->data(), f->size()))) {
+        err = "--db: " + path + " is not a rom2msx index (build one with --build-db)";
+        return nullptr;
     }
-    size_t in_banks = rom.size() / BANK_SIZE;
+    return (dbs[path] = std::move(f)).get();
+}
 
-    // Simple64K has a hard limit of 64 KiB window (8 banks).
-    if (type == CartType::Simple64K) {
-        if (in_banks > 8) {
-            die("ROM too large for Simple64K (max 64 KiB)");
+// The mapper of a ROM: its softwaredb record when --db has one (rec then
+// points at it), the bank-switch scan otherwise. seen describes the guess
+// for the report line. translate_rom() hands its guess on to resolve_type()
+// (known set), so a ROM is hashed and scanned once.
+struct MapperFound {
+    rom2msx::MapperGuess g;
+    const rom2msx::DbRecord* rec = nullptr;
+    std::string seen;
+    bool known = false;
+};
+
+static bool guess_mapper(const JobOptions& opt, span<const uint8_t> rom, MapperFound& found, std::string& err) {
+    rom2msx::MapperGuess& g = found.g;
+    const rom2msx::DbRecord*& rec = found.rec;
+    std::string& seen = found.seen;
+    rec = nullptr;
+    if (!opt.db_path.empty()) {
+        const InputFile* db = open_db(opt.db_path, err);
+        if (!db) return false;
+        uint8_t sha1[20];
+        rom2msx::Sha1 h;
+        h.update(rom.data(), rom.size());
+        h.final(sha1);
+        rec = rom2msx::db_lookup(span<const uint8_t>(db->data(), db->size()), sha1);
+    }
+    if (rec) {
+        g = rom2msx::MapperGuess();
+        g.mapper = static_cast<rom2msx::RomMapper>(rec->mapper);
+        g.confidence = 100;
+        seen = std::string(rom2msx::mapper_name(g.mapper)) + " (softwaredb)";
+    } else {
+        g = rom2msx::detect_mapper(rom);
+        seen = std::string(rom2msx::mapper_name(g.mapper)) + " (" + std::to_string(g.confidence) + "%)";
+    }
+    found.known = true;
+    return true;
+}
+
+// --type auto: pick the cart type from the ROM's softwaredb record (--db)
+// or, failing that, from the mapper its bank-switch writes point to. A
+// record's start address also picks the Simple64K start block unless --addr
+// was given. note gets the report fragment naming the mapper; found is used
+// as is if translate_rom() already filled it in.
+static bool resolve_type(JobOptions& opt, span<const uint8_t> rom, std::string& note, std::string& err,
+                         MapperFound& found) {
+    if (!found.known && !guess_mapper(opt, rom, found, err)) return false;
+    const rom2msx::MapperGuess& g = found.g;
+    const rom2msx::DbRecord* rec = found.rec;
+    const std::string& seen = found.seen;
+    if (!ok(rom2msx::type_for_mapper(g, rom.size(), opt.type), err)) {
+        err = "--type auto: " + err;
+        if (g.mapper != rom2msx::RomMapper::None) err += " (detected " + seen + ")";
+        bool translatable = g.mapper == rom2msx::RomMapper::Konami || g.mapper == rom2msx::RomMapper::ASCII8;
+        err += translatable ? "; pass --translate (or --type)" : "; pass --type";
+        return false;
+    }
+    if (rec && opt.type == CartType::Simple64K && opt.s64k_addr < 0 && rec->start_block < 8) {
+        opt.s64k_addr = rec->start_block;
+    }
+    opt.auto_type = false;
+    note = "; mapper: " + seen;
+    return true;
+}
+
+// --translate: a Konami or ASCII8 ROM has its bank-switch writes rewritten
+// to the Konami SCC registers, in place, and is converted as MegaSCC from
+// then on; log gets the patches. Konami SCC and plain ROMs are left as they
+// are (and --type auto goes on to resolve them as usual, from found).
+static bool translate_rom(JobOptions& opt, std::vector<uint8_t>& rom, std::vector<rom2msx::MapperPatch>& log,
+                          std::string& note, std::string& err, MapperFound& found) {
+    if (!opt.auto_type && opt.type != CartType::MegaSCC) {
+        err = "--translate produces MegaSCC images (use --type mega or auto)";
+        return false;
+    }
+    if (!guess_mapper(opt, rom, found, err)) return false;
+    const rom2msx::MapperGuess& g = found.g;
+    const std::string& seen = found.seen;
+    if (g.mapper == rom2msx::RomMapper::None || g.mapper == rom2msx::RomMapper::KonamiSCC) return true;
+    if (!ok(rom2msx::translate_mapper(rom, g.mapper, log), err)) {
+        err = "--translate: " + err + " (detected " + seen + ")";
+        return false;
+    }
+    opt.type = CartType::MegaSCC;
+    opt.auto_type = false;
+    note = "; mapper: " + seen + ", translated to Konami SCC (" + std::to_string(log.size()) + " writes)";
+    return true;
+}
+
+// The --translate patch log, <output>.patches: one "offset from to" line (hex)
+// per rewritten bank-switch write. With staged, it joins the image's group.
+static bool write_patch_log(const std::string& out_path, const std::string& note,
+                            const std::vector<rom2msx::MapperPatch>& log, size_t rom_bytes, std::string& err,
+                            std::vector<Staged>* staged) {
+    std::string text = "#" + note.substr(1) + "\n";
+    // The SCC's sound registers appear at 0x9800 while bank 63 is selected
+    // at 0x8000, which only an ASCII8 ROM of 512 KiB or more can ask for.
+    if (rom_bytes > 63 * BANK_SIZE) text += "# bank 63 at 0x8000 also enables the SCC sound registers at 0x9800\n";
+    text += "# offset from to\n";
+    for (const auto& pt : log) {
+        char line[32];
+        std::snprintf(line, sizeof(line), "0x%06zX %04X %04X\n", pt.offset, pt.from, pt.to);
+        text += line;
+    }
+    return write_file(out_path + ".patches", reinterpret_cast<const uint8_t*>(text.data()), text.size(), err,
+                      staged);
+}
+
+// Remove the <output>.patches of an earlier --translate run, now or (with
+// staged) along with the image's group.
+static void drop_patch_log(const std::string& out_path, std::vector<Staged>* staged) {
+    std::string path = out_path + ".patches";
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) return;
+    if (staged) staged->push_back(Staged{std::string(), path});
+    else std::filesystem::remove(path, ec);
+}
+
+static std::string report_line(const JobOptions& opt, const Placement& p) {
+    return std::string("Type: ") + type_name(opt.type) +
+           ", chip: " + std::to_string(opt.chip_kib) + " KiB, banks written: " + std::to_string(p.in_banks) +
+           ", start bank: " + std::to_string(p.start_bank) + ", bank size: 8 KiB";
+}
+
+enum class StatsMode { None, Text, Json };
+
+// The --checksum part of a report line.
+static std::string checksum_note(uint32_t crc32, uint16_t sum16, const std::string& sha1) {
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "; crc32: %08x, sum16: %04x, sha1: ", crc32, sum16);
+    return buf + sha1;
+}
+static std::string checksum_note(const rom2msx::ImageChecksum& sums) {
+    return checksum_note(sums.crc32(), sums.sum16(), sums.sha1());
+}
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
         }
     }
+    return out + "\"";
+}
+
+// The timing and counter fields, as one line of text or as JSON members
+// (without the enclosing braces) for the caller to extend.
+static std::string format_stats(const Stats& st, StatsMode mode) {
+    char buf[512];
+    if (mode == StatsMode::Json) {
+        std::snprintf(buf, sizeof(buf),
+                      "\"ns\":{\"read\":%llu,\"pad\":%llu,\"place\":%llu,\"write\":%llu,\"verify\":%llu,"
+                      "\"total\":%llu},\"bytes_read\":%llu,\"banks_written\":%llu,\"bytes_filled\":%llu,"
+                      "\"bytes_written\":%llu,\"bytes_verified\":%llu",
+                      (unsigned long long)st.read_ns, (unsigned long long)st.pad_ns,
+                      (unsigned long long)st.place_ns, (unsigned long long)st.write_ns,
+                      (unsigned long long)st.verify_ns, (unsigned long long)st.total_ns(),
+                      (unsigned long long)st.bytes_read, (unsigned long long)st.banks_written,
+                      (unsigned long long)st.bytes_filled, (unsigned long long)st.bytes_written,
+                      (unsigned long long)st.bytes_verified);
+    } else {
+        std::snprintf(buf, sizeof(buf),
+                      "read %.1f us, pad %.1f us, place %.1f us, write %.1f us, verify %.1f us; "
+                      "read %llu B, banks %llu, filled %llu B, written %llu B, verified %llu B",
+                      st.read_ns / 1e3, st.pad_ns / 1e3, st.place_ns / 1e3, st.write_ns / 1e3,
+                      st.verify_ns / 1e3, (unsigned long long)st.bytes_read,
+                      (unsigned long long)st.banks_written, (unsigned long long)st.bytes_filled,
+                      (unsigned long long)st.bytes_written, (unsigned long long)st.bytes_verified);
+    }
+    if (!st.checksummed) return buf;
+    char sums[64];
+    if (mode == StatsMode::Json) {
+        std::snprintf(sums, sizeof(sums), ",\"crc32\":\"%08x\",\"sum16\":\"%04x\"", st.crc32, st.sum16);
+        return buf + std::string(sums) + ",\"sha1\":\"" + st.sha1 + "\"";
+    }
+    std::snprintf(sums, sizeof(sums), "; crc32 %08x, sum16 %04x", st.crc32, st.sum16);
+    return buf + std::string(sums) + ", sha1 " + st.sha1;
+}
 
-    if (rom.size() > chip_bytes) {
-        die("Input ROM (after 8 KiB padding) is larger than selected chip size");
+// One JSON line describing a finished (or failed) job.
+static std::string job_json(const Job& job, bool ok, const std::string& err, const Stats& st) {
+    std::string s = "{\"input\":" + json_string(job.in_path) + ",\"output\":" + json_string(job.out_path) +
+                    ",\"ok\":" + (ok ? "true" : "false");
+    if (!ok) s += ",\"error\":" + json_string(err);
+    s += std::string(",\"cache_hit\":") + (st.cache_hit ? "true" : "false") + "," + format_stats(st, StatsMode::Json);
+    return s + "}";
+}
+
+// Convert between pipes: "-" as input reads the ROM from stdin, "-" as output
+// writes the image to stdout. The image is produced front to back (leading
+// 0xFF fill, the ROM banks, trailing fill), holding one bank at a time, so
+// memory stays flat whatever the chip size. Simple64K ROMs are at most 64 KiB
+// and are buffered whole, since the start bank depends on their size.
+// The image never exists as a whole, so --verify, --base, --cache and the
+// sparse formats are not available here; a ROM that turns out to be larger
+// than the chip fails after part of the image has gone to stdout (a file
+// output is staged, and removed again). staged is as for write_image().
+static bool convert_stream(const Job& job, std::string& report, std::string& err, Stats& st,
+                           std::vector<Staged>* staged) {
+    const JobOptions& opt = job.opt;
+    if (opt.verify != Verify::None || !opt.base_path.empty() || !opt.cache_dir.empty() ||
+        opt.format != Format::Bin) {
+        err = "\"-\" (stdin/stdout) only supports --format bin without --verify, --base or --cache";
+        return false;
+    }
+    if (opt.auto_type || opt.translate) {
+        err = "\"-\" (stdin/stdout) needs an explicit --type and no --translate (both have to see the whole ROM "
+              "first)";
+        return false;
+    }
+    std::string zip, member;
+    if (split_archive_path(job.in_path, zip, member)) {
+        err = "\"-\" (stdout) can't be combined with a zip input";
+        return false;
     }
+    size_t chip_bytes = opt.chip_bytes();
+    Stopwatch sw;
 
-    // Prepare output buffer filled with 0xFF (erased state)
-    std::vector<uint8_t> out(chip_bytes, 0xFF);
+    auto close_file = [](std::FILE* f) { if (f && f != stdin && f != stdout) std::fclose(f); };
+    std::unique_ptr<std::FILE, decltype(close_file)> in(
+        job.in_path == "-" ? stdin : std::fopen(job.in_path.c_str(), "rb"), close_file);
+    if (!in) { err = "Cannot open input file: " + job.in_path; return false; }
+    std::optional<StagedFile> staging;
+    if (job.out_path != "-") staging.emplace(job.out_path);
+    std::unique_ptr<std::FILE, decltype(close_file)> out(
+        staging ? std::fopen(staging->tmp().c_str(), "wb") : stdout, close_file);
+    if (!out) { err = "Cannot open output file: " + job.out_path; return false; }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
 
-    // Compute placement
-    size_t start_bank = 0;
+    static const std::vector<uint8_t> blank(BANK_SIZE, 0xFF);
+    rom2msx::ImageChecksum sums;
+    size_t emitted = 0;
+    auto emit = [&](const uint8_t* d, size_t n) {
+        if (std::fwrite(d, 1, n, out.get()) != n) {
+            err = "Failed to write output file";
+            return false;
+        }
+        emitted += n;
+        return true;
+    };
+    auto put = [&](const uint8_t* d, size_t n) {
+        if (opt.checksums) sums.data(d, n);
+        return emit(d, n);
+    };
+    auto fill = [&](size_t n) {
+        st.bytes_filled += n;
+        if (opt.checksums) sums.fill(n);
+        for (size_t k; n > 0; n -= k) {
+            k = std::min(n, BANK_SIZE);
+            if (!emit(blank.data(), k)) return false;
+        }
+        return true;
+    };
+    // Reads up to n bytes; a short count only at end of input.
+    auto get = [&](uint8_t* d, size_t n) {
+        size_t got = std::fread(d, 1, n, in.get());
+        st.bytes_read += got;
+        return got;
+    };
 
-    switch (type) {
-        case CartType::MegaSCC:
-            // Start bank = 0 always.
-            start_bank = 0;
-            break;
-        case CartType::RC755:
-            // Start bank = 0.
-            start_bank = 0;
-            break;
-        case CartType::Simple64K: {
-            if (s64k_addr >= 0) {
-                // Use requested block; must fit in 8 banks.
-                if (static_cast<size_t>(s64k_addr) + in_banks > 8) {
-                    die("Simple64K: --addr + bank_count exceeds 8 banks");
+    Placement p;
+    std::vector<uint8_t> bank(BANK_SIZE);
+    if (size_t window = rom2msx::mapper_info(opt.type).window_banks) {
+        // One byte past the window is enough to know it doesn't fit.
+        std::vector<uint8_t> rom(window * BANK_SIZE + 1);
+        rom.resize(get(rom.data(), rom.size()));
+        if (std::ferror(in.get())) { err = "Failed to read input file fully"; return false; }
+        sw.lap(st.read_ns);
+        if (!ok(rom2msx::plan_layout(opt, rom.size(), p), err)) return false;
+        p.rom = rom.data();
+        sw.lap(st.pad_ns);
+        rom.resize(p.in_banks * BANK_SIZE, 0xFF);
+        if (!fill(p.start_bank * BANK_SIZE) || !put(rom.data(), rom.size())) return false;
+    } else {
+        // MegaSCC/RC755 always start at bank 0: banks go out as they come in.
+        if (!ok(rom2msx::plan_layout(opt, 0, p), err)) return false;
+        for (size_t got; (got = get(bank.data(), BANK_SIZE)) > 0;) {
+            sw.lap(st.read_ns);
+            p.rom_bytes += got;
+            p.in_banks += 1;
+            if (p.in_banks * BANK_SIZE > chip_bytes) {
+                err = rom2msx::status_message(Status::RomLargerThanChip);
+                return false;
+            }
+            std::fill(bank.begin() + got, bank.end(), 0xFF);
+            if (!put(bank.data(), BANK_SIZE)) return false;
+            sw.lap(st.write_ns);
+            if (got < BANK_SIZE) break;
+        }
+        if (std::ferror(in.get())) { err = "Failed to read input file fully"; return false; }
+    }
+    if (!fill(chip_bytes - emitted)) return false;
+    if (std::fflush(out.get()) != 0) { err = "Failed to write output file"; return false; }
+    if (staging) {
+        if (std::fclose(out.release()) != 0) { err = "Failed to write output file"; return false; }
+        if (!staging->publish(staged, err)) return false;
+    }
+    st.banks_written = p.in_banks;
+    st.bytes_written = emitted;
+    sw.lap(st.write_ns);
+
+    report = report_line(opt, p);
+    if (opt.checksums) {
+        st.set_checksums(sums);
+        report += checksum_note(sums);
+    }
+    return true;
+}
+
+// The output of one size of a --chip list: "game.bin" -> "game-128k.bin".
+static std::string chip_path(const std::string& out_path, int kib) {
+    std::filesystem::path p(out_path);
+    std::string name = p.stem().string() + "-" + std::to_string(kib) + "k" + p.extension().string();
+    return (p.parent_path() / name).string();
+}
+
+// Produce one chip image of an input that has been read and planned: p
+// places it on opt's chip, arena.base is the --base image (if any) and mapper
+// the --type auto note for the report. The image is built under a staged
+// name and renamed over out_path when it is complete, or, with staged, added
+// there (with its cache entry) for the caller's group commit.
+static bool write_image(const std::string& out_path, const JobOptions& opt, const Placement& p, Arena& arena,
+                        const std::string& mapper, std::string& report, std::string& err, Stats& st,
+                        Stopwatch& sw, std::vector<Staged>* staged) {
+    const std::vector<uint8_t>& base = arena.base;
+    StagedFile staging(out_path);
+    const std::string& tmp = staging.tmp();
+    size_t chip_bytes = opt.chip_bytes();
+    // A cache hit replaces the whole conversion with a clone of the stored
+    // image. Only raw images can be checked (or diffed) after the fact, so a
+    // sparse format with --verify or --base always converts.
+    std::string entry;
+    if (!opt.cache_dir.empty()) {
+        entry = cache_entry(opt, p);
+        bool usable = opt.format == Format::Bin || (opt.verify == Verify::None && opt.base_path.empty());
+        if (usable && clone_cached(entry, tmp, opt.format == Format::Bin ? chip_bytes : 0)) {
+            st.cache_hit = true;
+            sw.lap(st.write_ns);
+            if (opt.checksums) {
+                rom2msx::ImageChecksum sums;
+                rom2msx::checksum_image(sums, chip_bytes, &p, 1);
+                st.set_checksums(sums);
+                sw.lap(st.place_ns);
+            }
+            if (opt.verify != Verify::None) {
+                if (!verify_file(tmp, chip_bytes, &p, 1, err)) return false;
+                st.bytes_verified = chip_bytes;
+                sw.lap(st.verify_ns);
+            }
+            std::string delta;
+            if (!opt.base_path.empty()) {
+                InputFile img;
+                if (!img.open(tmp, err)) return false;
+                if (!write_delta(img.data(), img.size(), base, out_path, delta, err, staged)) return false;
+                sw.lap(st.write_ns);
+            }
+            report = report_line(opt, p) + mapper;
+            if (st.checksummed) report += checksum_note(st.crc32, st.sum16, st.sha1);
+            if (opt.verify != Verify::None) report += "; verify: OK";
+            report += delta + "; cache: hit";
+            return staging.publish(staged, err);
+        }
+        uint64_t lookup_ns = 0; // the failed lookup is no phase of the conversion
+        sw.lap(lookup_ns);
+    }
+
+    std::string delta;
+    rom2msx::ImageChecksum sums;
+    rom2msx::ImageChecksum* want = opt.checksums ? &sums : nullptr;
+    if (opt.vectored()) {
+#ifndef _WIN32
+        if (!write_spans(tmp, chip_bytes, &p, 1, want, sw, st, err)) return false;
+#endif
+    } else if (opt.chunked()) {
+        if (!write_windows(tmp, chip_bytes, &p, 1, opt.verify == Verify::Mapped, want, arena.win, sw, st, err)) {
+            return false;
+        }
+    } else {
+        // Map the output at chip size and place the banks straight from the
+        // input mapping into the output one, 0xFF (erased state) around them
+        OutputFile out;
+        if (!out.create(tmp, chip_bytes, opt.format == Format::Bin, err, &arena.img)) return false;
+        sw.lap(st.write_ns);
+        rom2msx::render_window(span<uint8_t>(out.data(), chip_bytes), 0, &p, 1, want);
+        st.bytes_filled = chip_bytes - p.rom_bytes;
+        st.banks_written = p.in_banks;
+        sw.lap(st.place_ns);
+
+        // Validate: check that written banks match input and the rest is 0xFF
+        if (opt.verify_in_memory()) {
+            if (!verify_image(out.data(), out.size(), &p, 1, err)) return false;
+            st.bytes_verified = chip_bytes;
+            sw.lap(st.verify_ns);
+        }
+
+        if (!opt.base_path.empty() && !write_delta(out.data(), out.size(), base, out_path, delta, err, staged)) {
+            return false;
+        }
+
+        if (!commit_image(out, opt.format, err)) return false;
+        std::error_code ec;
+        st.bytes_written = opt.format == Format::Bin ? chip_bytes : std::filesystem::file_size(tmp, ec);
+        sw.lap(st.write_ns);
+    }
+
+    if (opt.verify_readback()) {
+        if (!verify_file(tmp, chip_bytes, &p, 1, err)) return false;
+        st.bytes_verified = chip_bytes;
+        sw.lap(st.verify_ns);
+    }
+
+    // Report
+    report = report_line(opt, p) + mapper;
+    if (want) {
+        st.set_checksums(sums);
+        report += checksum_note(sums);
+    }
+    if (opt.verify != Verify::None) report += "; verify: OK";
+    report += delta;
+    if (!entry.empty() && store_in_cache(tmp, entry, staged)) report += "; cache: miss";
+    if (!staging.publish(staged, err)) return false;
+    sw.lap(st.write_ns);
+    return true;
+}
+
+// The body of convert(): every output, side file and stale file to remove is
+// added to staged, in the order commit_staged() puts them in place.
+static bool convert_outputs(const Job& job, std::string& report, std::string& err, Stats& st, Arena& arena,
+                            bool prefetched, std::vector<Staged>* staged) {
+    if (!job.opt.chip_list.empty() && (job.in_path == "-" || job.out_path == "-" || !job.opt.base_path.empty())) {
+        err = "A --chip list can't be combined with \"-\" (stdin/stdout) or --base";
+        return false;
+    }
+    if (job.in_path == "-" || job.out_path == "-") return convert_stream(job, report, err, st, staged);
+    JobOptions opt = job.opt; // with the type resolved for --type auto
+    size_t chip_bytes = opt.chip_bytes();
+    Stopwatch sw;
+
+    RomInput in(arena.rom);
+    if (prefetched) in.use(span<const uint8_t>(arena.rom.data(), arena.rom.size()));
+    else if (!in.open(job.in_path, err)) return false;
+    arena.base.clear();
+    if (!load_base(opt, chip_bytes, arena.base, err)) return false;
+    st.bytes_read = in.size() + arena.base.size();
+    sw.lap(st.read_ns);
+
+    std::string mapper;
+    MapperFound found;
+    std::vector<rom2msx::MapperPatch> log;
+    if (opt.translate) {
+        std::vector<uint8_t>& copy = arena.copy;
+        copy.assign(in.data(), in.data() + in.size());
+        if (!translate_rom(opt, copy, log, mapper, err, found)) return false;
+        if (!mapper.empty()) in.use(span<const uint8_t>(copy.data(), copy.size()));
+    }
+    const std::string translated = mapper;
+    if (opt.auto_type && !resolve_type(opt, span<const uint8_t>(in.data(), in.size()), mapper, err, found)) {
+        return false;
+    }
+    Placement p;
+    if (!ok(rom2msx::plan_layout(opt, in.size(), p), err)) return false;
+    p.rom = in.data();
+    sw.lap(st.pad_ns);
+
+    // Every image gets its own .patches, staged just ahead of it; an earlier
+    // --translate run's log doesn't describe an untranslated image.
+    auto image = [&](const std::string& out_path, const JobOptions& o, std::string& line, Stats& s) {
+        if (translated.empty()) drop_patch_log(out_path, staged);
+        else if (!write_patch_log(out_path, translated, log, in.size(), err, staged)) return false;
+        return write_image(out_path, o, p, arena, mapper, line, err, s, sw, staged);
+    };
+    if (opt.chip_list.empty()) return image(job.out_path, opt, report, st);
+
+    // --chip a,b,...: the ROM has been read and planned once, on the largest
+    // chip; every size gets its own image from that placement (the raw ones
+    // all written from the same ROM bytes), and sizes it doesn't fit are
+    // skipped.
+    std::string lines;
+    size_t written = 0;
+    for (int kib : opt.chip_list) {
+        JobOptions one = opt;
+        one.chip_kib = kib;
+        one.chip_list.clear();
+        std::string out_path = chip_path(job.out_path, kib), line;
+        if ((p.start_bank + p.in_banks) * BANK_SIZE > one.chip_bytes()) {
+            lines += "\n  chip " + std::to_string(kib) + " KiB: skipped (" +
+                     rom2msx::status_message(Status::RomLargerThanChip) + ")";
+            continue;
+        }
+        Stats chip_st;
+        if (!image(out_path, one, line, chip_st)) {
+            err = out_path + ": " + err;
+            return false;
+        }
+        st.add(chip_st);
+        lines += "\n  " + out_path + ": " + line;
+        ++written;
+    }
+    report = "Chips: " + std::to_string(written) + " of " + std::to_string(opt.chip_list.size()) + " written" + lines;
+    if (written == 0) {
+        err = rom2msx::status_message(Status::RomLargerThanChip) + std::string(" (every --chip size)");
+        return false;
+    }
+    return true;
+}
+
+// Convert job.in_path to job.out_path. On success report holds the summary
+// line (without newline); on failure err holds the reason. st collects the
+// phase timings either way. arena holds the caller's buffers; with prefetched
+// set, arena.rom is the input already read by the batch prefetcher. With
+// staged, the outputs are left there for a group commit; otherwise they are
+// put in place together once all of them are done, so a failed conversion
+// publishes nothing (not even a .patches log).
+static bool convert(const Job& job, std::string& report, std::string& err, Stats& st, Arena& arena,
+                    bool prefetched = false, std::vector<Staged>* staged = nullptr) {
+    if (staged) return convert_outputs(job, report, err, st, arena, prefetched, staged);
+    std::vector<Staged> files;
+    if (!convert_outputs(job, report, err, st, arena, prefetched, &files)) {
+        discard_staged(files);
+        return false;
+    }
+    return commit_job(files, false, err);
+}
+
+// Split a manifest line into whitespace-separated fields; "..." groups a field
+// that contains spaces.
+static std::vector<std::string> split_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i]))) ++i;
+        if (i >= line.size()) break;
+        std::string field;
+        if (line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+            if (end == std::string::npos) end = line.size();
+            field = line.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else {
+            while (i < line.size() && !std::isspace(static_cast<unsigned char>(line[i]))) field += line[i++];
+        }
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+static bool load_manifest(const std::string& path, const JobOptions& defaults,
+                          std::vector<Job>& jobs, std::string& err) {
+    std::ifstream f(path);
+    if (!f) { err = "Cannot open manifest: " + path; return false; }
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(f, line)) {
+        ++lineno;
+        auto fields = split_fields(line);
+        if (fields.empty() || fields[0][0] == '#') continue;
+        if (fields.size() < 2) {
+            err = path + ":" + std::to_string(lineno) + ": expected \"input output [options]\"";
+            return false;
+        }
+        if (fields[0] == "-" || fields[1] == "-") {
+            err = path + ":" + std::to_string(lineno) + ": \"-\" (stdin/stdout) can't be used in a manifest";
+            return false;
+        }
+        Job job{fields[0], fields[1], defaults};
+        for (size_t i = 2; i < fields.size(); ++i) {
+            if (!parse_option(fields, i, job.opt, err)) {
+                err = path + ":" + std::to_string(lineno) + ": " + err;
+                return false;
+            }
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static bool collect_dir(const std::string& dir, const std::string& out_dir, const JobOptions& defaults,
+                        std::vector<Job>& jobs, std::string& err) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    std::vector<fs::path> inputs;
+    for (const auto& e : fs::directory_iterator(dir, ec)) {
+        if (e.is_regular_file() && is_rom_name(e.path())) inputs.push_back(e.path());
+    }
+    if (ec) { err = "Cannot read directory: " + dir; return false; }
+    std::sort(inputs.begin(), inputs.end());
+    for (const auto& in : inputs) {
+        fs::path out = out_dir.empty() ? in.parent_path() : fs::path(out_dir);
+        out /= in.stem();
+        out += format_extension(defaults.format);
+        jobs.push_back(Job{in.string(), out.string(), defaults});
+    }
+    return true;
+}
+
+// Every ROM member of a zip archive, in archive order, to <member stem>.bin
+// next to the archive or in out_dir.
+static bool collect_archive(const std::string& zip, const std::string& out_dir, const JobOptions& defaults,
+                            std::vector<Job>& jobs, std::string& err) {
+    namespace fs = std::filesystem;
+    auto archive = open_archive(zip, err);
+    if (!archive) return false;
+    std::map<std::string, std::string> outputs; // output -> member, to catch clashes
+    for (const auto& e : archive->entries) {
+        if (!is_rom_name(e.name)) continue;
+        fs::path out = out_dir.empty() ? fs::path(zip).parent_path() : fs::path(out_dir);
+        out /= fs::path(e.name).stem();
+        out += format_extension(defaults.format);
+        auto clash = outputs.emplace(out.string(), e.name);
+        if (!clash.second) {
+            err = zip + ": " + clash.first->second + " and " + e.name + " would both be written to " + out.string();
+            return false;
+        }
+        jobs.push_back(Job{zip + "#" + e.name, out.string(), defaults});
+    }
+    return true;
+}
+
+// Reads batch inputs ahead of the workers, so a ROM is already in memory
+// when a worker gets to its job: reads run up to `depth` jobs past the last
+// one taken. On Linux the reads are queued on io_uring by one thread;
+// without it (other systems, kernels or sandboxes that refuse it) `depth`
+// threads do plain reads. Zip members and "-" are left to convert(), as is
+// any input whose read fails, so errors are reported the usual way.
+// The read buffers circulate: take() swaps the worker's previous one back
+// into a pool the reads draw from, and every buffer is reserved at the
+// largest chip of the batch up front, so a batch allocates about depth +
+// workers buffers in all (any ROM that fits its chip is read without growing).
+class Prefetcher {
+public:
+    // Inputs larger than this aren't ROMs; convert() maps and rejects them.
+    static constexpr size_t MAX_BYTES = 64 * 1024 * 1024;
+
+    Prefetcher(const std::vector<Job>& jobs, unsigned depth)
+        : jobs_(jobs), depth_(depth), slots_(jobs.size()), horizon_(depth) {
+        for (const auto& job : jobs) reserve_ = std::max(reserve_, job.opt.chip_bytes());
+#ifdef ROM2MSX_IO_URING
+        if (ring_.init(std::max(depth, 1u))) {
+            backend_ = "io_uring";
+            threads_.emplace_back([this] { run_ring(); });
+            return;
+        }
+#endif
+        backend_ = "threads";
+        for (unsigned k = 0; k < depth_; ++k) threads_.emplace_back([this] { run_reader(); });
+    }
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    // Hand over job i's ROM in rom, waiting for its read; the buffer rom held
+    // goes back to the pool. False if the job wasn't prefetched and convert()
+    // has to open the input itself.
+    bool take(size_t i, std::vector<uint8_t>& rom) {
+        std::unique_lock<std::mutex> lock(mu_);
+        horizon_ = std::max(horizon_, i + 1 + depth_);
+        cv_.notify_all();
+        cv_.wait(lock, [&] { return slots_[i].state != Slot::Pending; });
+        if (slots_[i].state != Slot::Ready) return false;
+        rom.swap(slots_[i].data);
+        recycle(slots_[i].data);
+        slots_[i].state = Slot::Taken;
+        return true;
+    }
+
+    const char* backend() const { return backend_; }
+
+private:
+    struct Slot {
+        enum State { Pending, Ready, Skipped, Taken } state = Pending;
+        std::vector<uint8_t> data;
+    };
+
+    // Open job j's input for a prefetch: a regular file of sane size.
+    int open_input(size_t j, size_t& size) {
+        std::string zip, member;
+        const std::string& path = jobs_[j].in_path;
+        if (path == "-" || split_archive_path(path, zip, member)) return -1;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) > MAX_BYTES)) {
+            ::close(fd);
+            return -1;
+        }
+        if (fd >= 0) size = static_cast<size_t>(st.st_size);
+        return fd;
+    }
+
+    // A buffer of `size` bytes for job j's read, from the pool if possible.
+    void acquire(size_t j, size_t size) {
+        std::vector<uint8_t>& data = slots_[j].data;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            if (!pool_.empty()) {
+                data.swap(pool_.back());
+                pool_.pop_back();
+            }
+        }
+        if (data.capacity() == 0) data.reserve(std::max(size, reserve_));
+        data.resize(size);
+    }
+
+    // Return buffer to the pool (mu_ held).
+    void recycle(std::vector<uint8_t>& buffer) {
+        if (buffer.capacity() > 0) pool_.push_back(std::move(buffer));
+        buffer = std::vector<uint8_t>();
+    }
+
+    void finish(size_t j, bool ok) {
+        std::lock_guard<std::mutex> lock(mu_);
+        slots_[j].state = ok ? Slot::Ready : Slot::Skipped;
+        if (!ok) recycle(slots_[j].data);
+        cv_.notify_all();
+    }
+
+    // Wait until job j is within reach; false once stopping.
+    bool wait_for_horizon(size_t j) {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&] { return stop_ || j < horizon_; });
+        return !stop_;
+    }
+
+    void run_reader() {
+        for (;;) {
+            size_t j;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                cv_.wait(lock, [&] { return stop_ || next_ >= jobs_.size() || next_ < horizon_; });
+                if (stop_ || next_ >= jobs_.size()) return;
+                j = next_++;
+            }
+            size_t size = 0;
+            int fd = open_input(j, size);
+            bool ok = fd >= 0;
+            if (ok) {
+                acquire(j, size);
+                for (size_t done = 0; ok && done < size;) {
+                    ssize_t r = pread(fd, slots_[j].data.data() + done, size - done, static_cast<off_t>(done));
+                    if (r < 0 && errno == EINTR) continue;
+                    ok = r > 0;
+                    done += ok ? static_cast<size_t>(r) : 0;
+                }
+                ::close(fd);
+            }
+            finish(j, ok);
+        }
+    }
+
+#ifdef ROM2MSX_IO_URING
+    void run_ring() {
+        struct Read {
+            int fd;
+            size_t done;
+        };
+        std::map<size_t, Read> inflight;
+        for (size_t j = 0;;) {
+            // Queue reads up to the horizon, then reap one completion.
+            while (j < jobs_.size() && inflight.size() < depth_) {
+                {
+                    std::lock_guard<std::mutex> lock(mu_);
+                    if (stop_ || j >= horizon_) break;
+                }
+                size_t size = 0;
+                int fd = open_input(j, size);
+                if (fd >= 0 && size == 0) {
+                    ::close(fd);
+                    finish(j, true);
+                } else if (fd >= 0) {
+                    acquire(j, size);
+                    if (ring_.read(fd, slots_[j].data.data(), size, 0, j)) {
+                        inflight[j] = Read{fd, 0};
+                    } else {
+                        ::close(fd);
+                        finish(j, false);
+                    }
+                } else {
+                    finish(j, false);
+                }
+                ++j;
+            }
+            if (inflight.empty()) {
+                if (j >= jobs_.size() || !wait_for_horizon(j)) return;
+                continue;
+            }
+            uint64_t tag;
+            int res;
+            if (!ring_.wait(tag, res)) {
+                // The ring broke down: leave the outstanding jobs to convert().
+                for (auto& r : inflight) {
+                    ::close(r.second.fd);
+                    finish(r.first, false);
                 }
-                start_bank = static_cast<size_t>(s64k_addr);
+                inflight.clear();
+                continue;
+            }
+            auto it = inflight.find(tag);
+            if (it == inflight.end()) continue;
+            Read& r = it->second;
+            std::vector<uint8_t>& data = slots_[tag].data;
+            bool ok = res > 0;
+            if (ok) r.done += static_cast<size_t>(res);
+            if (ok && r.done < data.size() && ring_.read(r.fd, data.data() + r.done, data.size() - r.done, r.done, tag)) {
+                continue; // short read: queue the rest
+            }
+            ok = ok && r.done == data.size();
+            ::close(r.fd);
+            inflight.erase(it);
+            finish(tag, ok);
+        }
+    }
+
+    Ring ring_;
+#endif
+
+    const std::vector<Job>& jobs_;
+    size_t depth_;
+    std::vector<Slot> slots_;
+    size_t reserve_ = 0;                    // capacity of a new read buffer: the largest chip
+    std::vector<std::vector<uint8_t>> pool_; // read buffers given back by take()
+    const char* backend_ = "";
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    size_t horizon_ = 0; // jobs below this may be read ahead
+    size_t next_ = 0;    // next job for the reader threads
+    std::vector<std::thread> threads_;
+};
+
+// A programmer --burn drives: its name and the shell command that burns one
+// image, with {image}, {device} and {sectors} filled in per image.
+struct Burner {
+    std::string name;
+    std::string command;
+};
+
+// What --burn made of one image.
+struct BurnResult {
+    bool queued = false;
+    bool ok = false;
+    std::string device;   // that burned it
+    unsigned attempts = 0; // on all devices together
+    std::string err;
+};
+
+// The --burn devices file: one programmer per line, "name command...";
+// blank lines and lines starting with '#' are ignored.
+static bool load_burners(const std::string& path, std::vector<Burner>& burners, std::string& err) {
+    std::ifstream f(path);
+    if (!f) { err = "Cannot open --burn devices file: " + path; return false; }
+    std::string line;
+    for (size_t lineno = 1; std::getline(f, line); ++lineno) {
+        size_t a = line.find_first_not_of(" \t\r");
+        if (a == std::string::npos || line[a] == '#') continue;
+        size_t b = line.find_first_of(" \t", a);
+        size_t c = b == std::string::npos ? b : line.find_first_not_of(" \t", b);
+        if (c == std::string::npos) {
+            err = path + ":" + std::to_string(lineno) + ": expected \"name command...\"";
+            return false;
+        }
+        size_t e = line.find_last_not_of(" \t\r");
+        burners.push_back(Burner{line.substr(a, b - a), line.substr(c, e + 1 - c)});
+    }
+    if (burners.empty()) { err = path + ": no devices"; return false; }
+    return true;
+}
+
+// Quote s as one word for the shell that std::system() runs.
+static std::string shell_quote(const std::string& s) {
+#ifdef _WIN32
+    return "\"" + s + "\"";
+#else
+    std::string q = "'";
+    for (char c : s) q += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    return q + "'";
+#endif
+}
+
+// --burn: images are queued as their conversions finish and burned by one
+// thread per programmer, each taking the next image as soon as it is free.
+// A failed burn is retried `retries` times on the same device, then handed to
+// a device that hasn't tried it yet; a device that gives up on two images in
+// a row is taken off the line. Every attempt's output goes to <image>.burn.log.
+// With durable (--sync), the {sectors} list is flushed like the image was.
+class BurnLine {
+public:
+    BurnLine(const std::vector<Burner>& devices, unsigned retries, size_t jobs, bool durable = false)
+        : devices_(devices), retries_(retries), durable_(durable), results_(jobs), retired_(devices.size(), false) {
+        for (size_t d = 0; d < devices_.size(); ++d) threads_.emplace_back([this, d] { run(d); });
+    }
+
+    ~BurnLine() { finish(); }
+
+    // Queue job's finished image. sectors is false when {sectors} can't be
+    // produced (a sparse format).
+    void push(size_t job, const std::string& image, bool raw) {
+        std::lock_guard<std::mutex> lock(mu_);
+        results_[job].queued = true;
+        queue_.push_back(Item{job, image, raw, std::vector<bool>(devices_.size(), false)});
+        cv_.notify_all();
+    }
+
+    // Wait for every queued image to be burned or given up on.
+    const std::vector<BurnResult>& finish() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+        threads_.clear();
+        // Whatever no device could take is left over only if all were retired.
+        for (const Item& it : queue_) give_up(it, "no programmer left");
+        queue_.clear();
+        return results_;
+    }
+
+    size_t retired() const { return static_cast<size_t>(std::count(retired_.begin(), retired_.end(), true)); }
+
+private:
+    struct Item {
+        size_t job;
+        std::string image;
+        bool raw;
+        std::vector<bool> tried; // by device
+    };
+
+    void give_up(const Item& it, const std::string& why) {
+        BurnResult& r = results_[it.job];
+        r.ok = false;
+        if (r.err.empty()) r.err = why;
+    }
+
+    void run(size_t d) {
+        unsigned failed_in_a_row = 0;
+        for (;;) {
+            Item it;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                auto takeable = [&] {
+                    return std::find_if(queue_.begin(), queue_.end(), [&](const Item& x) { return !x.tried[d]; });
+                };
+                cv_.wait(lock, [&] { return takeable() != queue_.end() || (closed_ && busy_ == 0); });
+                auto at = takeable();
+                if (at == queue_.end()) return;
+                it = std::move(*at);
+                queue_.erase(at);
+                ++busy_;
+            }
+            std::string err;
+            unsigned attempts = 0;
+            bool ok = burn(devices_[d], it, attempts, err);
+            std::lock_guard<std::mutex> lock(mu_);
+            --busy_;
+            BurnResult& r = results_[it.job];
+            r.attempts += attempts;
+            if (ok) {
+                r.ok = true;
+                r.device = devices_[d].name;
+                r.err.clear();
+                failed_in_a_row = 0;
             } else {
-                // Auto selection: <=32 KiB -> start at block 2 (0x4000), else block 0 (0x0000).
-                size_t size_kib = rom.size() / 1024;
-                if (size_kib <= 32) start_bank = 2;
-                else start_bank = 0;
-                // Sanity: ensure it fits.
-                if (start_bank + in_banks > 8) {
-                    die("Simple64K: auto start doesn't fit; try a smaller ROM or pass --addr");
+                r.err = devices_[d].name + ": " + err + (r.err.empty() ? "" : "; " + r.err);
+                it.tried[d] = true;
+                bool other = false;
+                for (size_t k = 0; k < devices_.size(); ++k) other = other || (!it.tried[k] && !retired_[k]);
+                if (other) queue_.push_back(std::move(it));
+                if (++failed_in_a_row == 2) retired_[d] = true;
+            }
+            cv_.notify_all();
+            if (retired_[d]) {
+                // Images only this device had left to try can't be burned now.
+                for (auto k = queue_.begin(); k != queue_.end();) {
+                    bool other = false;
+                    for (size_t j = 0; j < devices_.size(); ++j) other = other || (!k->tried[j] && !retired_[j]);
+                    if (other) {
+                        ++k;
+                    } else {
+                        give_up(*k, "no programmer left");
+                        k = queue_.erase(k);
+                    }
                 }
+                return;
             }
-            break;
         }
     }
 
-    // Place banks
-    for (size_t bank = 0; bank < in_banks; ++bank) {
-        size_t dst_bank = start_bank + bank;
-        size_t dst_off = dst_bank * BANK_SIZE;
-        size_t src_off = bank * BANK_SIZE;
-        if (dst_off + BANK_SIZE > out.size()) {
-            die("Output overflow: bank placement exceeds selected chip size");
+    // Run the device's command on one image, up to 1 + retries_ times.
+    bool burn(const Burner& dev, const Item& it, unsigned& attempts, std::string& err) {
+        std::string cmd = dev.command, sectors;
+        if (cmd.find("{sectors}") != std::string::npos) {
+            if (!it.raw) { err = "{sectors} needs --format bin"; return false; }
+            sectors = it.image + ".program";
+            if (!write_program_list(it.image, sectors, durable_, err)) return false;
+        }
+        // One left-to-right pass over the template: substituted (quoted)
+        // values are never scanned again, whatever braces they contain.
+        const std::pair<const char*, const std::string*> keys[] = {
+            {"{image}", &it.image}, {"{device}", &dev.name}, {"{sectors}", &sectors}};
+        for (size_t at = 0; (at = cmd.find('{', at)) != std::string::npos;) {
+            const std::string* value = nullptr;
+            size_t len = 0;
+            for (const auto& k : keys) {
+                len = std::strlen(k.first);
+                if (cmd.compare(at, len, k.first) == 0) {
+                    value = k.second;
+                    break;
+                }
+            }
+            if (!value) {
+                ++at;
+                continue;
+            }
+            std::string quoted = shell_quote(*value);
+            cmd.replace(at, len, quoted);
+            at += quoted.size();
+        }
+        std::string log = it.image + ".burn.log";
+        std::string run = "(" + cmd + ") >> " + shell_quote(log) + " 2>&1";
+        for (attempts = 1;; ++attempts) {
+            std::ofstream(log, std::ios::app) << "# " << dev.name << ", attempt " << attempts << ": " << cmd << "\n";
+            int rc = std::system(run.c_str());
+#ifndef _WIN32
+            if (rc != -1 && WIFEXITED(rc)) rc = WEXITSTATUS(rc);
+#endif
+            if (rc == 0) return true;
+            err = "exit status " + std::to_string(rc) + " (see " + log + ")";
+            if (attempts > retries_) return false;
         }
-        std::memcpy(out.data() + dst_off, rom.data() + src_off, BANK_SIZE);
     }
 
-    write_file(out_path, out);
+    // {sectors}: the image's non-blank sectors as "index offset" lines, for
+    // flashers that program sector by sector and can leave erased ones be.
+    static bool write_program_list(const std::string& image, const std::string& path, bool durable,
+                                   std::string& err) {
+        InputFile img;
+        if (!img.open(image, err)) return false;
+        std::string list = "# rom2msx non-blank sectors: index offset (sector size " + std::to_string(SECTOR_SIZE) + ")\n";
+        for (size_t s = 0; s * SECTOR_SIZE < img.size(); ++s) {
+            size_t n = std::min(SECTOR_SIZE, img.size() - s * SECTOR_SIZE);
+            if (all_ff(img.data() + s * SECTOR_SIZE, n)) continue;
+            char line[48];
+            std::snprintf(line, sizeof(line), "%zu 0x%06zX\n", s, s * SECTOR_SIZE);
+            list += line;
+        }
+        std::vector<Staged> files;
+        return write_file(path, reinterpret_cast<const uint8_t*>(list.data()), list.size(), err, &files) &&
+               commit_job(files, durable, err);
+    }
 
-    // Report
-    std::cout << "Type: ";
-    switch (type) {
-        case CartType::MegaSCC:   std::cout << "MegaSCC"; break;
-        case CartType::RC755:     std::cout << "RC755"; break;
-        case CartType::Simple64K: std::cout << "Simple64K"; break;
-    }
-    std::cout << ", chip: " << chip_kib << " KiB, banks written: " << in_banks
-              << ", start bank: " << start_bank << ", bank size: 8 KiB";
-    if (verify) {
-        // Validate: check that written banks match input and the rest is 0xFF
-        std::ifstream vf(out_path, std::ios::binary);
-        vf.seekg(0, std::ios::end);
-        size_t vlen = static_cast<size_t>(vf.tellg());
-        vf.seekg(0, std::ios::beg);
-        std::vector<uint8_t> vb(vlen);
-        vf.read(reinterpret_cast<char*>(vb.data()), vlen);
-        if (!vf) die("--verify: failed to read output back");
-        // Check banks
-        for (size_t bank = 0; bank < in_banks; ++bank) {
-            size_t dst_off = (start_bank + bank) * BANK_SIZE;
-            for (size_t i = 0; i < BANK_SIZE; ++i) {
-                if (vb[dst_off + i] != rom[bank * BANK_SIZE + i]) {
-                    die("--verify: mismatch in bank " + std::to_string(bank));
+    const std::vector<Burner>& devices_;
+    unsigned retries_;
+    bool durable_;
+    std::vector<BurnResult> results_;
+    std::vector<bool> retired_;
+    std::deque<Item> queue_;
+    size_t busy_ = 0; // images being burned (which may come back to the queue)
+    bool closed_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<std::thread> threads_;
+};
+
+struct JobResult {
+    bool ok = false;
+    std::string text; // report line or error
+    Stats stats;
+};
+
+// The report fragment for an image's --burn result; false if it failed.
+static bool burn_note(const BurnResult& r, std::string& note) {
+    if (!r.ok) {
+        note = "; burn failed: " + r.err;
+        return false;
+    }
+    note = "; burned on " + r.device;
+    if (r.attempts > 1) note += " (attempt " + std::to_string(r.attempts) + ")";
+    return true;
+}
+
+// The --burn summary line for the images of `results`.
+static bool burn_summary(const std::vector<BurnResult>& results, const std::vector<Burner>& burners,
+                         const BurnLine& line, std::string& summary) {
+    size_t queued = 0, burned = 0;
+    for (const auto& r : results) queued += r.queued, burned += r.ok;
+    summary = "Burn: " + std::to_string(queued) + " images on " + std::to_string(burners.size()) + " programmer(s), " +
+              std::to_string(burned) + " burned, " + std::to_string(queued - burned) + " failed";
+    if (line.retired()) summary += ", " + std::to_string(line.retired()) + " programmer(s) taken off the line";
+    return burned == queued;
+}
+
+// Run every job on `workers` threads, with the inputs read up to `depth`
+// jobs ahead (0: no read-ahead); results come back in job order. backend
+// gets the prefetcher's I/O backend, if any. With sync_every (--sync N), the
+// outputs are staged and committed durably N jobs at a time by whichever
+// worker fills the group, the rest after the last job; groups gets their
+// count. A job whose files don't all reach their targets fails with
+// commit_staged()'s account of what was replaced. burn, if given, gets every
+// image as soon as it is in place.
+static std::vector<JobResult> run_jobs(const std::vector<Job>& jobs, unsigned workers, unsigned depth,
+                                       unsigned sync_every, std::string& backend, size_t& groups,
+                                       BurnLine* burn = nullptr) {
+    std::vector<JobResult> results(jobs.size());
+    std::atomic<size_t> next{0};
+    std::unique_ptr<Prefetcher> prefetch;
+    if (depth > 0) {
+        prefetch = std::make_unique<Prefetcher>(jobs, depth);
+        backend = prefetch->backend();
+    }
+    auto placed = [&](size_t i) {
+        if (burn) burn->push(i, jobs[i].out_path, jobs[i].opt.format == Format::Bin);
+    };
+    std::mutex sync_mu;
+    std::vector<Staged> pending;  // outputs of the group being filled
+    std::vector<size_t> members;  // and its jobs
+    groups = 0;
+    auto commit = [&](const std::vector<Staged>& files, const std::vector<size_t>& group) {
+        std::map<size_t, std::string> failed;
+        commit_staged(files, true, failed);
+        for (size_t i : group) {
+            auto it = failed.find(i);
+            if (it == failed.end()) {
+                placed(i);
+            } else {
+                results[i].ok = false;
+                results[i].text = it->second;
+            }
+        }
+    };
+    auto worker = [&]() {
+        Arena arena;
+        std::vector<Staged> staged;
+        for (size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+            std::string report, err;
+            // Time spent blocked on the read-ahead is this job's read time;
+            // convert() only adds wrapping the buffer that arrived.
+            Stopwatch wait;
+            bool read = prefetch && prefetch->take(i, arena.rom);
+            wait.lap(results[i].stats.read_ns);
+            staged.clear();
+            results[i].ok =
+                convert(jobs[i], report, err, results[i].stats, arena, read, sync_every ? &staged : nullptr);
+            results[i].text = results[i].ok ? report : err;
+            if (!results[i].ok) {
+                discard_staged(staged);
+                continue;
+            }
+            if (!sync_every) {
+                placed(i);
+                continue;
+            }
+            for (auto& f : staged) f.job = i;
+            std::vector<Staged> files;
+            std::vector<size_t> group;
+            {
+                std::lock_guard<std::mutex> lock(sync_mu);
+                pending.insert(pending.end(), staged.begin(), staged.end());
+                members.push_back(i);
+                if (members.size() >= sync_every) {
+                    files.swap(pending);
+                    group.swap(members);
+                    ++groups;
                 }
             }
+            if (!group.empty()) commit(files, group);
         }
-        // Check 0xFF elsewhere
-        for (size_t i = 0; i < vb.size(); ++i) {
-            bool within_written = false;
-            size_t bank_idx = i / BANK_SIZE;
-            if (bank_idx >= start_bank && bank_idx < start_bank + in_banks) within_written = true;
-            if (!within_written && vb[i] != 0xFF) die("--verify: non-0xFF found outside written area");
+    };
+    workers = std::max(1u, std::min<unsigned>(workers, static_cast<unsigned>(jobs.size())));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < workers; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+    if (!members.empty()) {
+        ++groups;
+        commit(pending, members);
+    }
+    return results;
+}
+
+// The jobs of a --batch source: a directory, a zip archive or a manifest.
+static std::vector<Job> load_jobs(const std::string& source, const std::string& out_dir, const JobOptions& defaults) {
+    std::vector<Job> jobs;
+    std::string err;
+    std::string zip, member;
+    bool loaded;
+    if (std::filesystem::is_directory(source)) {
+        loaded = collect_dir(source, out_dir, defaults, jobs, err);
+    } else if (split_archive_path(source, zip, member) && member.empty()) {
+        loaded = collect_archive(source, out_dir, defaults, jobs, err);
+    } else {
+        loaded = load_manifest(source, defaults, jobs, err);
+    }
+    if (!loaded) die(err);
+    if (jobs.empty()) die("--batch: nothing to convert in " + source);
+    return jobs;
+}
+
+// The usual flash part for each --chip size, with typical datasheet figures
+// for the --plan time estimates.
+struct ChipPart {
+    int kib;
+    const char* name;
+    size_t sector_bytes; // erase unit
+    double byte_us;      // programming time per byte
+    double sector_erase_ms;
+    double chip_erase_ms;
+};
+
+static const ChipPart CHIP_PARTS[] = {
+    {64, "SST39SF512", 4096, 14, 18, 70},
+    {128, "SST39SF010", 4096, 14, 18, 70},
+    {256, "SST39SF020", 4096, 14, 18, 70},
+    {512, "SST39SF040", 4096, 14, 18, 70},
+    {1024, "AM29F080B", 65536, 7, 1000, 16000},
+    {2048, "AM29F016D", 65536, 7, 1000, 25000},
+    {4096, "AM29F032B", 65536, 7, 1000, 64000},
+    {8192, "S29GL064N", 65536, 7.5, 500, 64000}, // buffered writes: 240 us per 32 bytes
+};
+
+static const ChipPart& chip_part(int kib) {
+    for (const auto& part : CHIP_PARTS) {
+        if (part.kib == kib) return part;
+    }
+    return CHIP_PARTS[1];
+}
+
+// --plan: where job's ROM goes on every --chip size, as one JSON line in
+// json. Only the file size is read, unless --type auto or --translate have
+// to see the ROM for its mapper (or it is a zip member); no image is
+// produced. False if the input couldn't be read or its type resolved.
+static bool plan_input(const Job& job, std::string& json) {
+    JobOptions opt = job.opt;
+    std::string err, mapper;
+    json = "{\"input\":" + json_string(job.in_path);
+    auto fail = [&] {
+        json += ",\"ok\":false,\"error\":" + json_string(err) + "}";
+        return false;
+    };
+    size_t rom_bytes = 0;
+    std::string zip, member;
+    if (opt.auto_type || opt.translate || split_archive_path(job.in_path, zip, member)) {
+        Arena arena;
+        RomInput in(arena.rom);
+        if (!in.open(job.in_path, err)) return fail();
+        span<const uint8_t> rom(in.data(), in.size());
+        MapperFound found;
+        if (opt.translate) {
+            arena.copy.assign(rom.begin(), rom.end());
+            std::vector<rom2msx::MapperPatch> log;
+            if (!translate_rom(opt, arena.copy, log, mapper, err, found)) return fail();
+        }
+        if (opt.auto_type && !resolve_type(opt, rom, mapper, err, found)) return fail();
+        rom_bytes = rom.size();
+    } else {
+        std::error_code ec;
+        rom_bytes = static_cast<size_t>(std::filesystem::file_size(job.in_path, ec));
+        if (ec) {
+            err = "Cannot open input file: " + job.in_path;
+            return fail();
+        }
+    }
+    rom2msx::MapperInfo info = rom2msx::mapper_info(opt.type);
+    json += ",\"ok\":true,\"rom_bytes\":" + std::to_string(rom_bytes) + ",\"type\":" + json_string(info.name) +
+            ",\"window_banks\":" + std::to_string(info.window_banks) +
+            ",\"bank_align\":" + std::to_string(info.bank_align) + ",\"movable\":" + (info.movable ? "true" : "false");
+    if (!mapper.empty()) json += ",\"mapper\":" + json_string(mapper.substr(mapper.find(": ") + 2));
+
+    std::vector<int> chips = opt.chip_list.empty() ? std::vector<int>{opt.chip_kib} : opt.chip_list;
+    json += ",\"chips\":[";
+    for (size_t k = 0; k < chips.size(); ++k) {
+        JobOptions one = opt;
+        one.chip_kib = chips[k];
+        one.chip_list.clear();
+        const ChipPart& part = chip_part(chips[k]);
+        Placement p;
+        Status s = rom2msx::plan_layout(one, rom_bytes, p);
+        if (k) json += ",";
+        json += "{\"chip_kib\":" + std::to_string(chips[k]) + ",\"part\":" + json_string(part.name) +
+                ",\"fits\":" + (s == Status::Ok ? "true" : "false");
+        if (s != Status::Ok) {
+            json += ",\"error\":" + json_string(rom2msx::status_message(s)) + "}";
+            continue;
+        }
+        // The ROM bytes are programmed (the 0xFF padding and fill are left
+        // erased) into the sectors they reach; the rest stay erased.
+        size_t lo = p.start_bank * BANK_SIZE, hi = lo + rom_bytes;
+        size_t sectors = one.chip_bytes() / part.sector_bytes;
+        size_t used = rom_bytes ? (hi + part.sector_bytes - 1) / part.sector_bytes - lo / part.sector_bytes : 0;
+        double erase_ms = std::min(used * part.sector_erase_ms, part.chip_erase_ms);
+        double program_ms = rom_bytes * part.byte_us / 1000;
+        char times[128];
+        std::snprintf(times, sizeof(times), ",\"erase_ms\":%.0f,\"program_ms\":%.0f,\"total_ms\":%.0f", erase_ms,
+                      program_ms, erase_ms + program_ms);
+        json += ",\"banks\":" + std::to_string(p.in_banks) + ",\"start_bank\":" + std::to_string(p.start_bank) +
+                ",\"offset\":" + std::to_string(lo) +
+                ",\"padding\":" + std::to_string(p.in_banks * BANK_SIZE - rom_bytes) +
+                ",\"sector_bytes\":" + std::to_string(part.sector_bytes) +
+                ",\"used_sectors\":" + std::to_string(used) + ",\"erased_sectors\":" + std::to_string(sectors - used) +
+                times + "}";
+    }
+    json += "]}";
+    return true;
+}
+
+// Print the --plan line of every job; 1 if any input couldn't be planned.
+static int run_plan(const std::vector<Job>& jobs) {
+    bool all = true;
+    for (const auto& job : jobs) {
+        std::string json;
+        all = plan_input(job, json) && all;
+        std::cout << json << "\n";
+    }
+    return all ? 0 : 1;
+}
+
+static int run_batch(const std::string& source, const std::string& out_dir, const JobOptions& defaults,
+                     unsigned workers, unsigned depth, unsigned sync_every, StatsMode stats, const std::vector<Burner>& burners,
+                     unsigned retries) {
+    std::vector<Job> jobs = load_jobs(source, out_dir, defaults);
+
+    auto t0 = Clock::now();
+    std::string backend;
+    std::unique_ptr<BurnLine> burn;
+    if (!burners.empty()) {
+        for (const auto& job : jobs) {
+            if (!job.opt.chip_list.empty()) die("--burn can't be combined with a --chip list");
+        }
+        burn = std::make_unique<BurnLine>(burners, retries, jobs.size(), sync_every != 0);
+    }
+    size_t groups = 0;
+    auto results = run_jobs(jobs, workers, depth, sync_every, backend, groups, burn.get());
+    const std::vector<BurnResult>* burned = burn ? &burn->finish() : nullptr;
+    auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+    workers = static_cast<unsigned>(std::min<size_t>(std::max(1u, workers), jobs.size()));
+
+    size_t failed = 0;
+    Stats total;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const JobResult& r = results[i];
+        if (r.ok) {
+            std::string note;
+            if (burned) burn_note((*burned)[i], note);
+            std::cout << jobs[i].in_path << " -> " << jobs[i].out_path << ": " << r.text << note << "\n";
+        } else {
+            ++failed;
+            std::cerr << jobs[i].in_path << ": Error: " << r.text << "\n";
         }
-        std::cout << "; verify: OK";
+        if (stats == StatsMode::Text) std::cout << "  Stats: " << format_stats(r.stats, stats) << "\n";
+        if (stats == StatsMode::Json) std::cout << job_json(jobs[i], r.ok, r.text, r.stats) << "\n";
+        total.add(r.stats);
+    }
+    char elapsed[32];
+    std::snprintf(elapsed, sizeof(elapsed), "%.3f", elapsed_ns / 1e9);
+    std::cout << "Batch: " << jobs.size() << " jobs, " << (jobs.size() - failed) << " converted, "
+              << failed << " failed, " << elapsed << " s on " << workers << " worker(s)";
+    if (!backend.empty()) std::cout << ", read-ahead " << depth << " (" << backend << ")";
+    if (sync_every) std::cout << ", synced in " << groups << " group(s) of up to " << sync_every;
+    std::cout << "\n";
+    bool all_burned = true;
+    if (burned) {
+        std::string summary;
+        all_burned = burn_summary(*burned, burners, *burn, summary);
+        std::cout << summary << "\n";
+    }
+    if (stats == StatsMode::Text) std::cout << "Stats (total): " << format_stats(total, stats) << "\n";
+    if (stats == StatsMode::Json) {
+        std::cout << "{\"batch\":{\"jobs\":" << jobs.size() << ",\"failed\":" << failed
+                  << ",\"workers\":" << workers << ",\"queue_depth\":" << depth
+                  << ",\"read_ahead\":" << json_string(backend) << ",\"sync_every\":" << sync_every
+                  << ",\"sync_groups\":" << groups << ",\"elapsed_ns\":" << elapsed_ns << "},"
+                  << format_stats(total, stats) << "}\n";
+    }
+    return failed || !all_burned ? 1 : 0;
+}
+
+// One image checked by --audit: the ROM it was converted from, and what is
+// wrong with it (status empty if nothing).
+struct AuditItem {
+    std::string rom;
+    std::string image;
+    std::string status; // missing, size, mismatch, not-blank or error
+    std::string detail;
+    size_t bytes = 0;   // image bytes compared
+};
+
+// Check one image against its ROM by the --verify rules, without producing
+// the image again: the ROM is planned with the --audit options on a chip of
+// the image's size and compared with the mapped image.
+static void audit_image(AuditItem& item, const JobOptions& defaults, Arena& arena) {
+    auto fail = [&](const char* status, const std::string& detail) {
+        item.status = status;
+        item.detail = detail;
+    };
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(item.image, ec)) return fail("missing", "no image");
+    JobOptions opt = defaults;
+    std::string err;
+    InputFile img;
+    if (!img.open(item.image, err)) return fail("error", err);
+    int kib = static_cast<int>(img.size() / 1024);
+    if (img.size() % 1024 != 0 || !rom2msx::valid_chip_kib(kib)) {
+        return fail("size", std::to_string(img.size()) + " bytes is not a chip size");
+    }
+    opt.chip_kib = kib;
+    opt.chip_list.clear();
+
+    RomInput in(arena.rom);
+    if (!in.open(item.rom, err)) return fail("error", err);
+    span<const uint8_t> rom(in.data(), in.size());
+    std::string note;
+    MapperFound found;
+    if (opt.translate) {
+        arena.copy.assign(rom.begin(), rom.end());
+        std::vector<rom2msx::MapperPatch> log;
+        if (!translate_rom(opt, arena.copy, log, note, err, found)) return fail("error", err);
+        rom = span<const uint8_t>(arena.copy.data(), arena.copy.size());
+    }
+    if (opt.auto_type && !resolve_type(opt, rom, note, err, found)) return fail("error", err);
+    Placement p;
+    if (Status s = rom2msx::plan_layout(opt, rom.size(), p); s != Status::Ok) {
+        return fail("size", std::to_string(kib) + " KiB image: " + rom2msx::status_message(s));
+    }
+    p.rom = rom.data();
+    size_t bad_bank = 0;
+    Status s = rom2msx::verify(span<const uint8_t>(img.data(), img.size()), &p, 1, &bad_bank);
+    item.bytes = img.size();
+    if (s == Status::VerifyBankMismatch) return fail("mismatch", "bank " + std::to_string(bad_bank));
+    if (s == Status::VerifyNotBlank) return fail("not-blank", rom2msx::status_message(s));
+    if (s != Status::Ok) return fail("error", rom2msx::status_message(s));
+}
+
+// --audit dir: every ROM in the tree is paired with <name>.bin next to it and
+// the pairs are checked on `workers` threads, each taking the next unchecked
+// pair as it finishes one. The images that fail are listed as a table.
+static int run_audit(const std::string& dir, const JobOptions& defaults, unsigned workers) {
+    namespace fs = std::filesystem;
+    if (!defaults.base_path.empty() || !defaults.cache_dir.empty()) {
+        die("--audit can't be combined with --base or --cache");
+    }
+    std::vector<AuditItem> items;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file() || !is_rom_name(it->path())) continue;
+        fs::path image = it->path();
+        image.replace_extension(".bin");
+        items.push_back(AuditItem{it->path().string(), image.string(), "", "", 0});
+    }
+    if (ec) die("Cannot read directory: " + dir);
+    if (items.empty()) die("--audit: no ROMs in " + dir);
+    std::sort(items.begin(), items.end(), [](const AuditItem& a, const AuditItem& b) { return a.rom < b.rom; });
+
+    auto t0 = Clock::now();
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        Arena arena;
+        for (size_t i; (i = next.fetch_add(1)) < items.size();) audit_image(items[i], defaults, arena);
+    };
+    workers = std::max(1u, std::min<unsigned>(workers, static_cast<unsigned>(items.size())));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < workers; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    size_t failed = 0, bytes = 0;
+    for (const auto& item : items) {
+        bytes += item.bytes;
+        if (item.status.empty()) continue;
+        if (failed++ == 0) std::printf("%-9s  %-36s  %s\n", "status", "detail", "image");
+        std::printf("%-9s  %-36s  %s\n", item.status.c_str(), item.detail.c_str(), item.image.c_str());
+    }
+    std::printf("Audit: %zu images (%.1f MiB), %zu OK, %zu failed, %.3f s on %u worker(s)\n", items.size(),
+                bytes / (1024.0 * 1024.0), items.size() - failed, failed, secs, workers);
+    return failed ? 1 : 0;
+}
+
+// --verify-dump: build the image of in_path in memory and compare a chip
+// readback with it sector by sector. Nothing is written; the exit status is 1
+// if the readback differs.
+static int run_verify_dump(const std::string& in_path, const std::string& dump_path, const JobOptions& defaults) {
+    if (in_path == "-" || !defaults.chip_list.empty() || !defaults.base_path.empty() || !defaults.cache_dir.empty()) {
+        die("--verify-dump can't be combined with \"-\", a --chip list, --base or --cache");
     }
+    JobOptions opt = defaults;
+    std::string err, mapper;
+    Arena arena;
+    RomInput in(arena.rom);
+    if (!in.open(in_path, err)) die(err);
+    span<const uint8_t> rom(in.data(), in.size());
+    MapperFound found;
+    if (opt.translate) {
+        arena.copy.assign(rom.begin(), rom.end());
+        std::vector<rom2msx::MapperPatch> log;
+        if (!translate_rom(opt, arena.copy, log, mapper, err, found)) die(err);
+        rom = span<const uint8_t>(arena.copy.data(), arena.copy.size());
+    }
+    if (opt.auto_type && !resolve_type(opt, rom, mapper, err, found)) die(err);
+    std::vector<uint8_t> img(opt.chip_bytes());
+    Placement p;
+    rom2msx::ImageChecksum sums;
+    if (!ok(rom2msx::convert(rom, opt, img, &p, opt.checksums ? &sums : nullptr), err)) die(err);
+
+    InputFile dump;
+    if (!dump.open(dump_path, err)) die(err);
+    if (dump.size() != img.size()) {
+        die("--verify-dump: " + dump_path + " is " + std::to_string(dump.size()) + " bytes, expected the chip size (" +
+            std::to_string(img.size()) + ")");
+    }
+    rom2msx::DumpDiff diff;
+    rom2msx::diff_dump(img, span<const uint8_t>(dump.data(), dump.size()), diff);
+
+    std::cout << report_line(opt, p) << mapper << (opt.checksums ? checksum_note(sums) : "") << "\n";
+    size_t sectors = img.size() / SECTOR_SIZE;
+    if (diff.sectors.empty()) {
+        std::cout << "Readback: " << dump_path << " matches (" << sectors << " sectors)\n";
+        return 0;
+    }
+    std::cout << "Readback: " << dump_path << ": " << diff.sectors.size() << " of " << sectors
+              << " sectors differ, " << diff.bytes << " bytes; " << diff.rose << " bits read 1 where 0 was expected, "
+              << diff.fell << " bits read 0 where 1 was expected\n";
+    std::printf("%6s  %-8s  %5s  %6s  %6s  %s\n", "sector", "offset", "bytes", "0->1", "1->0", "looks like");
+    for (const auto& s : diff.sectors) {
+        // Erasing sets a whole sector to 0xFF and programming only clears bits,
+        // so bits stuck at 0 in a blank sector point at the erase, bits that
+        // stayed 1 at the program step.
+        bool blank = all_ff(img.data() + s.sector * SECTOR_SIZE, SECTOR_SIZE);
+        const char* cause = s.rose && s.fell ? "mixed" : s.fell ? (blank ? "failed erase" : "bits stuck at 0")
+                                                                : "failed program";
+        std::printf("%6zu  0x%06zX  %5zu  %6zu  %6zu  %s\n", s.sector, s.sector * SECTOR_SIZE, s.bytes, s.rose, s.fell,
+                    cause);
+    }
+    std::cout << "Data lines (0->1/1->0):";
+    for (int k = 0; k < 8; ++k) std::cout << " D" << k << " " << diff.line_rose[k] << "/" << diff.line_fell[k];
     std::cout << "\n";
+    return 1;
+}
+
+// Waits for the --watch input to be rewritten. On Linux inotify watches the
+// input's directory for the file being closed after a write or renamed into
+// place (the two ways assemblers and editors replace a file); on macOS and
+// the BSDs kqueue watches the file itself; elsewhere its size and time stamp
+// are polled.
+class FileWatch {
+public:
+    explicit FileWatch(const std::string& path) : path_(path) {
+        std::filesystem::path p(path);
+        name_ = p.filename().string();
+#if defined(__linux__)
+        fd_ = inotify_init1(IN_CLOEXEC);
+        std::string dir = p.parent_path().empty() ? "." : p.parent_path().string();
+        if (fd_ >= 0 && inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#elif defined(ROM2MSX_KQUEUE)
+        kq_ = kqueue();
+        reopen();
+#endif
+        stamp(size_, mtime_);
+    }
+
+    FileWatch(const FileWatch&) = delete;
+    FileWatch& operator=(const FileWatch&) = delete;
+
+    ~FileWatch() {
+#if defined(__linux__)
+        if (fd_ >= 0) ::close(fd_);
+#elif defined(ROM2MSX_KQUEUE)
+        if (file_ >= 0) ::close(file_);
+        if (kq_ >= 0) ::close(kq_);
+#endif
+    }
+
+    const char* backend() const {
+#if defined(__linux__)
+        if (fd_ >= 0) return "inotify";
+#elif defined(ROM2MSX_KQUEUE)
+        if (kq_ >= 0) return "kqueue";
+#endif
+        return "polling";
+    }
+
+    // Return once the file has changed; changes that follow within a few
+    // milliseconds (a build writing in several steps) are folded into one.
+    void wait() {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            while (!read_events(-1)) {
+            }
+            while (read_events(SETTLE_MS)) {
+            }
+            return;
+        }
+#elif defined(ROM2MSX_KQUEUE)
+        if (kq_ >= 0) {
+            while (!vnode_event(nullptr)) {
+            }
+            struct timespec settle = {0, SETTLE_MS * 1000000L};
+            while (vnode_event(&settle)) {
+            }
+            return;
+        }
+#endif
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+            uintmax_t size;
+            std::filesystem::file_time_type mtime;
+            stamp(size, mtime);
+            if (size == size_ && mtime == mtime_) continue;
+            // Changed: wait for it to hold still.
+            do {
+                size_ = size, mtime_ = mtime;
+                std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+                stamp(size, mtime);
+            } while (size != size_ || mtime != mtime_);
+            return;
+        }
+    }
+
+private:
+    static constexpr int SETTLE_MS = 20;
+    static constexpr int POLL_MS = 100;
+
+    void stamp(uintmax_t& size, std::filesystem::file_time_type& mtime) const {
+        std::error_code ec;
+        size = std::filesystem::file_size(path_, ec);
+        mtime = std::filesystem::last_write_time(path_, ec);
+    }
+
+#if defined(__linux__)
+    // Read the events available within timeout_ms (-1: wait); true if one
+    // was about the input.
+    bool read_events(int timeout_ms) {
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int rc = ::poll(&pfd, 1, timeout_ms);
+        if (rc <= 0) return false;
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t n = ::read(fd_, buf, sizeof(buf));
+        bool hit = false;
+        for (ssize_t at = 0; at < n;) {
+            const auto* e = reinterpret_cast<const struct inotify_event*>(buf + at);
+            if (e->len > 0 && name_ == e->name) hit = true;
+            at += static_cast<ssize_t>(sizeof(struct inotify_event) + e->len);
+        }
+        return hit;
+    }
+
+    int fd_ = -1;
+#elif defined(ROM2MSX_KQUEUE)
+    // (Re)open the input for its vnode events; the file may be missing for a
+    // moment while it is being replaced.
+    void reopen() {
+        if (file_ >= 0) ::close(file_);
+        for (int tries = 0; (file_ = ::open(path_.c_str(), O_RDONLY)) < 0 && tries < 100; ++tries) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+        }
+        if (file_ < 0) return;
+        struct kevent ev;
+        EV_SET(&ev, file_, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+               NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr);
+        kevent(kq_, &ev, 1, nullptr, 0, nullptr);
+    }
+
+    // One vnode event within timeout (nullptr: wait); true if there was one.
+    bool vnode_event(const struct timespec* timeout) {
+        struct kevent ev;
+        if (kevent(kq_, nullptr, 0, &ev, 1, timeout) <= 0) return false;
+        if (ev.fflags & (NOTE_DELETE | NOTE_RENAME)) reopen(); // replaced: follow the new file
+        return true;
+    }
+
+    int kq_ = -1;
+    int file_ = -1;
+#endif
+
+    std::string path_;
+    std::string name_;
+    uintmax_t size_ = 0;
+    std::filesystem::file_time_type mtime_;
+};
+
+// What the last --watch build of a raw image holds: the ROM it was built from
+// and the identity of the file it went to, so that a rebuild whose layout
+// hasn't moved only patches the banks that changed into a clone (a reflink,
+// else a copy) of that file, staged and renamed over it like any output. A
+// rebuild with --verify, --cache, --translate, --type auto, a --chip list, a
+// sparse format or a --base other than the output itself, one whose ROM
+// changed size and one whose output was touched by anything else converts in
+// full (and keeps that).
+class WatchImage {
+public:
+    // Keep job's freshly converted output for the next rebuild, if it can be
+    // rebuilt from a clone at all. Nothing is kept on any error.
+    void keep(const Job& job, Arena& arena) {
+        kept_ = false;
+#ifndef _WIN32
+        const JobOptions& opt = job.opt;
+        std::error_code ec;
+        if (opt.format != Format::Bin || !opt.chip_list.empty() || !opt.cache_dir.empty() || opt.translate ||
+            opt.auto_type || opt.verify != Verify::None) {
+            return;
+        }
+        if (!opt.base_path.empty() && !std::filesystem::equivalent(opt.base_path, job.out_path, ec)) return;
+        std::string err;
+        RomInput in(arena.rom);
+        if (!in.open(job.in_path, err) || !ok(rom2msx::plan_layout(opt, in.size(), p_), err)) return;
+        InputFile img;
+        if (!img.open(job.out_path, err) || img.size() != opt.chip_bytes() || !stat_output(job.out_path)) return;
+        // The input may have been rewritten again since it was converted.
+        for (size_t k = 0; k < p_.in_banks; ++k) {
+            size_t off = k * BANK_SIZE;
+            if (std::memcmp(img.data() + (p_.start_bank + k) * BANK_SIZE, in.data() + off,
+                            std::min(BANK_SIZE, p_.rom_bytes - off)) != 0) {
+                return;
+            }
+        }
+        rom_.assign(in.data(), in.data() + in.size());
+        // The delta is against the previous build, which is the image itself.
+        if (!opt.base_path.empty()) last_.assign(img.data(), img.data() + img.size());
+        else last_.clear();
+        kept_ = true;
+#else
+        (void)job;
+        (void)arena;
+#endif
+    }
+
+    // Rebuild job from the kept build. Returns false, having written nothing,
+    // when the rebuild needs a full conversion instead; otherwise converted
+    // tells whether it succeeded (report or err as for convert()).
+    bool rebuild(const Job& job, Arena& arena, std::string& report, std::string& err, Stats& st,
+                 bool& converted) {
+#ifndef _WIN32
+        if (!kept_) return false;
+        // The output was replaced or written to behind our back.
+        struct stat now;
+        if (::lstat(job.out_path.c_str(), &now) != 0 || !same_output(now)) {
+            kept_ = false;
+            return false;
+        }
+        const JobOptions& opt = job.opt;
+        Stopwatch sw;
+        converted = false;
+        RomInput in(arena.rom);
+        if (!in.open(job.in_path, err)) return true;
+        st.bytes_read = in.size();
+        sw.lap(st.read_ns);
+        Placement p;
+        if (!ok(rom2msx::plan_layout(opt, in.size(), p), err)) return true;
+        if (p.rom_bytes != p_.rom_bytes || p.start_bank != p_.start_bank || p.in_banks != p_.in_banks) {
+            kept_ = false;
+            return false;
+        }
+        p.rom = in.data();
+        sw.lap(st.pad_ns);
+
+        // Only whole banks are compared and stored; the 0xFF around them (and
+        // the tail of a partial last bank) is already in the clone.
+        StagedFile staging(job.out_path);
+        if (!clone_file(job.out_path, staging.tmp())) {
+            err = "Cannot create output file: " + staging.tmp();
+            return true;
+        }
+        int fd = ::open(staging.tmp().c_str(), O_WRONLY);
+        if (fd < 0) {
+            err = "Cannot open output file: " + staging.tmp();
+            return true;
+        }
+        size_t changed = 0, written = 0;
+        bool failed = false;
+        for (size_t k = 0; k < p.in_banks && !failed; ++k) {
+            size_t off = k * BANK_SIZE;
+            size_t len = std::min(BANK_SIZE, p.rom_bytes - off);
+            if (std::memcmp(in.data() + off, rom_.data() + off, len) == 0) continue;
+            off_t at = static_cast<off_t>((p.start_bank + k) * BANK_SIZE);
+            failed = ::pwrite(fd, in.data() + off, len, at) != static_cast<ssize_t>(len);
+            if (!last_.empty()) std::memcpy(&last_[static_cast<size_t>(at)], in.data() + off, len);
+            ++changed;
+            written += len;
+        }
+        if (::close(fd) != 0 || failed) {
+            err = "Failed to write output file";
+            kept_ = false; // last_ may already hold banks that never made it out
+            return true;
+        }
+        st.banks_written = changed;
+        st.bytes_written = written;
+        sw.lap(st.write_ns);
+        rom2msx::ImageChecksum sums;
+        if (opt.checksums) {
+            rom2msx::checksum_image(sums, opt.chip_bytes(), &p, 1);
+            st.set_checksums(sums);
+            sw.lap(st.place_ns);
+        }
+        // last_ is the new image now; the previous build is what was published.
+        std::string delta;
+        if (!last_.empty()) {
+            std::vector<uint8_t>& base = arena.base;
+            if (!read_file(job.out_path, base, err) ||
+                !write_delta(last_.data(), last_.size(), base, job.out_path, delta, err, nullptr)) {
+                kept_ = false;
+                return true;
+            }
+            sw.lap(st.write_ns);
+        }
+        if (!stat_output(staging.tmp()) || !staging.publish(nullptr, err)) {
+            kept_ = false;
+            if (err.empty()) err = "Cannot replace output file: " + job.out_path;
+            return true;
+        }
+        std::memcpy(rom_.data(), in.data(), in.size());
+        sw.lap(st.write_ns);
+        report = report_line(opt, p);
+        if (opt.checksums) report += checksum_note(sums);
+        report += delta + "; patched: " + std::to_string(changed) + " of " + std::to_string(p.in_banks) +
+                  " banks changed";
+        converted = true;
+        return true;
+#else
+        (void)job, (void)arena, (void)report, (void)err, (void)st, (void)converted;
+        return false;
+#endif
+    }
+
+private:
+#ifndef _WIN32
+    // Remember path as the published build (it is about to be renamed
+    // there). Only a regular file can be cloned and staged.
+    bool stat_output(const std::string& path) {
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+        st_ = st;
+        return true;
+    }
+
+    bool same_output(const struct stat& st) const {
+#if defined(__APPLE__)
+        const struct timespec &a = st.st_mtimespec, &b = st_.st_mtimespec;
+#else
+        const struct timespec &a = st.st_mtim, &b = st_.st_mtim;
+#endif
+        return st.st_dev == st_.st_dev && st.st_ino == st_.st_ino && st.st_size == st_.st_size &&
+               a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    struct stat st_ {};
+#endif
+    bool kept_ = false;
+    Placement p_;
+    std::vector<uint8_t> rom_;  // the ROM the published image holds
+    std::vector<uint8_t> last_; // with --base, the image being built (= the published one between builds)
+};
+
+// --watch: convert job now and again every time its input is rewritten,
+// until the process is killed. The worker's buffers (and the mapping of
+// --db) stay warm between rebuilds; with --base pointing at the output, each
+// delta is against the previous build. Rebuilds that only change ROM bytes
+// patch the changed banks into a staged clone of the output (WatchImage).
+static int run_watch(const Job& job, StatsMode stats, const std::vector<Burner>& burners, unsigned retries) {
+    if (job.in_path == "-" || job.out_path == "-") die("--watch needs an input and an output file, not \"-\"");
+    std::string zip, member;
+    if (split_archive_path(job.in_path, zip, member)) die("--watch can't watch a zip member");
+    if (!burners.empty() && !job.opt.chip_list.empty()) die("--burn can't be combined with a --chip list");
+    FileWatch watch(job.in_path); // before the first build, so no change is missed
+    std::cout << "Watching " << job.in_path << " (" << watch.backend() << ")" << std::endl;
+    Arena arena;
+    WatchImage image;
+    for (;;) {
+        auto t0 = Clock::now();
+        std::string report, err;
+        Stats st;
+        bool converted = false;
+        if (!image.rebuild(job, arena, report, err, st, converted)) {
+            converted = convert(job, report, err, st, arena);
+            if (converted) image.keep(job, arena);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+        char when[16];
+        std::time_t now = std::time(nullptr);
+        std::strftime(when, sizeof(when), "%H:%M:%S", std::localtime(&now));
+        if (converted) {
+            std::cout << "[" << when << "] " << report << " (" << us << " us)" << std::endl;
+            if (!burners.empty()) {
+                BurnLine line(burners, retries, 1);
+                line.push(0, job.out_path, job.opt.format == Format::Bin);
+                std::string note;
+                burn_note(line.finish()[0], note);
+                std::cout << "[" << when << "] " << job.out_path << ":" << note.substr(1) << std::endl;
+            }
+        } else {
+            std::cerr << "[" << when << "] Error: " << err << std::endl;
+        }
+        if (stats == StatsMode::Text) std::cout << "Stats: " << format_stats(st, stats) << std::endl;
+        if (stats == StatsMode::Json) std::cout << job_json(job, converted, err, st) << std::endl;
+        watch.wait();
+    }
+}
+
+// One ROM of a --pack image. "path@N" pins a Simple64K ROM to start block N
+// inside its 64 KiB window, like --addr does for a single conversion.
+struct PackItem {
+    std::string path;
+    int addr = -1;
+    std::vector<uint8_t> buf; // an inflated zip member
+    RomInput in{buf};
+    Placement p;
+};
+
+static size_t pow2_banks(size_t banks) {
+    size_t n = 1;
+    while (n < banks) n <<= 1;
+    return n;
+}
+
+// Lay several ROMs out in one chip image, filling in each item's start bank.
+// MegaSCC/RC755 ROMs keep the single-ROM rule of starting on bank 0 of their
+// own block: each block is the ROM's size rounded up to a power of two and is
+// aligned to that size. Blocks are placed largest first at the lowest free
+// aligned offset, which for power-of-two sizes never leaves a hole that a
+// later (smaller) ROM can't use. Simple64K ROMs each get a 64 KiB window of
+// their own, in order, placed inside it by the usual start-bank rule.
+static bool plan_pack(const JobOptions& base, std::vector<PackItem>& items, std::string& err) {
+    size_t chip_banks = base.chip_bytes() / BANK_SIZE;
+    for (auto& it : items) {
+        JobOptions o = base;
+        o.s64k_addr = it.addr;
+        if (!ok(rom2msx::plan_layout(o, it.in.size(), it.p), err)) {
+            err = it.path + ": " + err;
+            return false;
+        }
+        if (it.p.in_banks == 0) {
+            err = it.path + ": empty ROM";
+            return false;
+        }
+    }
+
+    if (size_t window = rom2msx::mapper_info(base.type).window_banks) {
+        if (items.size() * window > chip_banks) {
+            err = "--pack: " + std::to_string(items.size()) + " " + type_name(base.type) + " ROMs need " +
+                  std::to_string(items.size() * window * BANK_SIZE / 1024) + " KiB, chip has " +
+                  std::to_string(base.chip_kib) + " KiB";
+            return false;
+        }
+        for (size_t k = 0; k < items.size(); ++k) items[k].p.start_bank += k * window;
+        return true;
+    }
+
+    std::vector<size_t> order(items.size());
+    for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return pow2_banks(items[a].p.in_banks) > pow2_banks(items[b].p.in_banks);
+    });
+    std::vector<bool> used(chip_banks, false);
+    for (size_t k : order) {
+        PackItem& it = items[k];
+        size_t block = pow2_banks(it.p.in_banks);
+        size_t off = 0;
+        for (; off + block <= chip_banks; off += block) {
+            if (std::none_of(used.begin() + off, used.begin() + off + block, [](bool u) { return u; })) break;
+        }
+        if (off + block > chip_banks) {
+            err = "--pack: no room left for " + it.path + " (" + std::to_string(block) + " aligned banks)";
+            return false;
+        }
+        std::fill(used.begin() + off, used.begin() + off + block, true);
+        it.p.start_bank += off;
+    }
+    return true;
+}
+
+// --dedup replaces the block layout with one bank per distinct 8 KiB bank
+// (rom2msx::dedup_banks) and writes <output>.banks, the per-ROM bank map a
+// menu loader remaps the mapper registers with.
+static int run_pack(const std::string& out_path, const std::vector<std::string>& roms, const JobOptions& opt,
+                    bool dedup, bool sync) {
+    if (roms.empty()) die("--pack requires at least one input ROM");
+    if (opt.auto_type) die("--pack needs an explicit --type (mega|rc755|s64k)");
+    if (!opt.chip_list.empty()) die("--pack takes a single --chip size");
+    if (opt.translate) die("--pack doesn't translate; convert the ROMs with --translate first");
+    if (dedup && rom2msx::mapper_info(opt.type).window_banks) {
+        die("--dedup needs --type mega or rc755 (Simple64K windows can't be remapped)");
+    }
+    std::string err;
+    std::vector<PackItem> items(roms.size());
+    for (size_t k = 0; k < roms.size(); ++k) {
+        PackItem& it = items[k];
+        it.path = roms[k];
+        size_t at = it.path.rfind('@');
+        if (at != std::string::npos && at + 2 == it.path.size() && it.path[at + 1] >= '0' && it.path[at + 1] <= '7') {
+            if (!rom2msx::mapper_info(opt.type).movable) die("--pack: @addr is only valid for --type s64k: " + it.path);
+            it.addr = it.path[at + 1] - '0';
+            it.path.resize(at);
+        }
+        if (!it.in.open(it.path, err)) die(err);
+        it.p.rom = it.in.data();
+    }
+    size_t chip_bytes = opt.chip_bytes();
+    std::vector<Placement> placed;
+    std::vector<std::vector<size_t>> maps;
+    if (dedup) {
+        std::vector<span<const uint8_t>> data;
+        for (const auto& it : items) {
+            if (it.in.size() == 0) die(it.path + ": empty ROM");
+            data.emplace_back(it.in.data(), it.in.size());
+        }
+        rom2msx::dedup_banks(data, placed, maps);
+        if (placed.size() > chip_bytes / BANK_SIZE) {
+            die("--pack --dedup: " + std::to_string(placed.size()) + " distinct banks, chip has " +
+                std::to_string(chip_bytes / BANK_SIZE));
+        }
+    } else {
+        if (!plan_pack(opt, items, err)) die(err);
+        for (const auto& it : items) placed.push_back(it.p);
+        std::sort(placed.begin(), placed.end(),
+                  [](const Placement& a, const Placement& b) { return a.start_bank < b.start_bank; });
+    }
+    std::vector<uint8_t> base;
+    if (!load_base(opt, chip_bytes, base, err)) die(err);
+    std::string delta;
+    rom2msx::ImageChecksum sums;
+    // The image and its side files (.sectors/.delta, .banks) are built under
+    // staged names (removed again if anything fails) and put in place together
+    // once verified, flushed first with --sync.
+    std::vector<Staged> files;
+    auto write = [&] {
+        StagedFile staging(out_path);
+        const std::string& tmp = staging.tmp();
+        Stopwatch sw;
+        Stats st;
+        if (opt.vectored()) {
+#ifndef _WIN32
+            if (!write_spans(tmp, chip_bytes, placed.data(), placed.size(), opt.checksums ? &sums : nullptr, sw, st,
+                             err)) {
+                return false;
+            }
+#endif
+        } else if (opt.chunked()) {
+            std::vector<uint8_t> win;
+            if (!write_windows(tmp, chip_bytes, placed.data(), placed.size(), opt.verify == Verify::Mapped,
+                               opt.checksums ? &sums : nullptr, win, sw, st, err)) {
+                return false;
+            }
+        } else {
+            OutputFile out;
+            if (!out.create(tmp, chip_bytes, opt.format == Format::Bin, err)) return false;
+            // plan_pack keeps the ROMs inside the chip, so only the gaps are filled.
+            rom2msx::render_window(span<uint8_t>(out.data(), chip_bytes), 0, placed.data(), placed.size(),
+                                   opt.checksums ? &sums : nullptr);
+            if (opt.verify_in_memory() && !verify_image(out.data(), out.size(), placed.data(), placed.size(), err)) {
+                return false;
+            }
+            if (!opt.base_path.empty() && !write_delta(out.data(), out.size(), base, out_path, delta, err, &files)) {
+                return false;
+            }
+            if (!commit_image(out, opt.format, err)) return false;
+        }
+        if (opt.verify_readback() && !verify_file(tmp, chip_bytes, placed.data(), placed.size(), err)) return false;
+        if (dedup) {
+            auto map = rom2msx::encode_bank_map(maps);
+            if (!write_file(out_path + ".banks", map.data(), map.size(), err, &files)) return false;
+        }
+        return staging.publish(&files, err);
+    };
+    if (!write()) {
+        discard_staged(files);
+        die(err);
+    }
+    if (!commit_job(files, sync, err)) die(err);
+
+    // Placement table
+    size_t used = 0;
+    for (const auto& it : items) used += (it.in.size() + BANK_SIZE - 1) / BANK_SIZE;
+    std::cout << "Pack: " << type_name(opt.type) << ", chip: " << opt.chip_kib << " KiB, ROMs: " << items.size()
+              << ", banks used: ";
+    if (dedup) std::cout << placed.size() << " of " << chip_bytes / BANK_SIZE << " (" << used << " without --dedup)";
+    else std::cout << used << " of " << chip_bytes / BANK_SIZE;
+    std::cout << ", bank size: 8 KiB";
+    if (opt.checksums) std::cout << checksum_note(sums);
+    if (opt.verify != Verify::None) std::cout << "; verify: OK";
+    std::cout << delta;
+    if (dedup) std::cout << "; bank map: " << out_path << ".banks";
+    std::cout << "\n";
+    if (dedup) {
+        // A ROM's shared banks are the ones stored for an earlier bank (of
+        // it or of a ROM before it).
+        std::cout << "  #  banks  shared  rom\n";
+        for (size_t k = 0; k < items.size(); ++k) {
+            const uint8_t* lo = items[k].in.data();
+            const uint8_t* hi = lo + items[k].in.size();
+            size_t own = 0;
+            for (size_t i = 0; i < maps[k].size(); ++i) {
+                const uint8_t* at = placed[maps[k][i]].rom;
+                if (at == lo + i * BANK_SIZE && at < hi) ++own;
+            }
+            char line[64];
+            std::snprintf(line, sizeof(line), "%3zu  %5zu  %6zu  ", k, maps[k].size(), maps[k].size() - own);
+            std::cout << line << items[k].path << "\n";
+        }
+        return 0;
+    }
+    std::cout << "  #  start  banks  offset    rom\n";
+    for (size_t k = 0; k < items.size(); ++k) {
+        char line[64];
+        std::snprintf(line, sizeof(line), "%3zu  %5zu  %5zu  0x%06zX  ", k, items[k].p.start_bank,
+                      items[k].p.in_banks, items[k].p.start_bank * BANK_SIZE);
+        std::cout << line << items[k].path << "\n";
+    }
     return 0;
 }
+
+#ifndef _WIN32
+// --serve: a long-running converter behind a Unix or TCP socket. Every
+// request is one ROM plus conversion options; the reply is the image in the
+// requested format. Each worker owns its ROM and chip buffers, which grow to
+// the largest request seen and are reused after that, so a request costs no
+// process start, no file I/O and (for raw images) no allocation.
+//
+// Request:  "R2MQ", options length, ROM length (32-bit little-endian), the
+//           options text (manifest syntax: "--type s64k --format ihex"),
+//           then the ROM bytes.
+// Response: "R2MS", status (0 ok, 1 error), 3 reserved bytes, text length,
+//           data length (32-bit little-endian), the text (the report line,
+//           or the error), then the data (the image).
+// A connection can carry any number of requests; it is closed after
+// SERVE_IDLE_S seconds without one.
+
+constexpr size_t SERVE_MAX_OPTIONS = 4096;
+constexpr int SERVE_IDLE_S = 10;
+
+static uint32_t get_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0] | p[1] << 8 | p[2] << 16) | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static void set_le32(uint8_t* p, size_t v) {
+    for (int k = 0; k < 4; ++k) p[k] = static_cast<uint8_t>(v >> (8 * k));
+}
+
+static bool read_full(int fd, void* dst, size_t n) {
+    auto* p = static_cast<uint8_t*>(dst);
+    while (n > 0) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+static bool write_full(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t w = ::writev(fd, iov, count);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return false;
+        size_t left = static_cast<size_t>(w);
+        for (; count > 0 && left >= iov->iov_len; ++iov, --count) left -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// What one worker keeps between requests.
+struct ServeBuffers {
+    std::vector<uint8_t> rom;
+    std::vector<uint8_t> img;
+    std::vector<uint8_t> encoded;
+    std::string text;
+};
+
+// Convert b.rom with the request's options on top of the --serve defaults.
+static bool serve_convert(const std::string& options, const JobOptions& defaults, ServeBuffers& b,
+                          span<const uint8_t>& data, std::string& err) {
+    JobOptions opt = defaults;
+    auto args = split_fields(options);
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!parse_option(args, i, opt, err)) return false;
+    }
+    // Requests can't name files on the server: --db is the one given to --serve.
+    if (!opt.base_path.empty() || !opt.cache_dir.empty() || !opt.chip_list.empty() ||
+        opt.db_path != defaults.db_path) {
+        err = "--base, --cache, --db and --chip lists are not available in --serve requests";
+        return false;
+    }
+    std::string mapper;
+    std::vector<rom2msx::MapperPatch> log;
+    MapperFound found;
+    if (opt.translate && !translate_rom(opt, b.rom, log, mapper, err, found)) return false;
+    span<const uint8_t> rom(b.rom.data(), b.rom.size());
+    if (opt.auto_type && !resolve_type(opt, rom, mapper, err, found)) return false;
+    size_t chip_bytes = opt.chip_bytes();
+    if (b.img.size() < chip_bytes) b.img.resize(chip_bytes);
+    span<uint8_t> img(b.img.data(), chip_bytes);
+    Placement p;
+    rom2msx::ImageChecksum sums;
+    if (!ok(rom2msx::convert(rom, opt, img, &p, opt.checksums ? &sums : nullptr), err)) return false;
+    if (opt.verify != Verify::None && !verify_image(img.data(), img.size(), &p, 1, err)) return false;
+
+    b.text = report_line(opt, p) + mapper;
+    if (opt.checksums) b.text += checksum_note(sums);
+    if (opt.verify != Verify::None) b.text += "; verify: OK";
+    if (opt.format == Format::Bin) {
+        data = img;
+        return true;
+    }
+    auto ranges = rom2msx::find_ranges(img, 16);
+    if (opt.format == Format::Ranges) {
+        b.encoded = rom2msx::encode_ranges(img, ranges);
+    } else {
+        std::string text = opt.format == Format::IHex ? rom2msx::encode_ihex(img, ranges)
+                                                      : rom2msx::encode_srec(img, ranges);
+        b.encoded.assign(text.begin(), text.end());
+    }
+    data = span<const uint8_t>(b.encoded.data(), b.encoded.size());
+    return true;
+}
+
+// Answer one request on fd. False when the connection should be closed (end
+// of stream, a malformed request or a failed write).
+static bool serve_request(int fd, const JobOptions& defaults, ServeBuffers& b) {
+    uint8_t hdr[12];
+    if (!read_full(fd, hdr, sizeof(hdr))) return false;
+    size_t options_len = get_le32(hdr + 4);
+    size_t rom_len = get_le32(hdr + 8);
+    bool sane = std::memcmp(hdr, "R2MQ", 4) == 0 && options_len <= SERVE_MAX_OPTIONS && rom_len <= 8192 * 1024;
+    std::string options(sane ? options_len : 0, '\0');
+    if (sane) {
+        b.rom.resize(rom_len);
+        if (!read_full(fd, &options[0], options_len) || !read_full(fd, b.rom.data(), rom_len)) return false;
+    }
+
+    std::string err;
+    span<const uint8_t> data;
+    bool converted = sane && serve_convert(options, defaults, b, data, err);
+    if (!sane) err = "malformed request (bad magic, or options/ROM too large)";
+    const std::string& text = converted ? b.text : err;
+    uint8_t reply[16] = {'R', '2', 'M', 'S', static_cast<uint8_t>(converted ? 0 : 1)};
+    set_le32(reply + 8, text.size());
+    set_le32(reply + 12, data.size());
+    struct iovec iov[3] = {{reply, sizeof(reply)},
+                           {const_cast<char*>(text.data()), text.size()},
+                           {const_cast<uint8_t*>(data.data()), data.size()}};
+    return write_full(fd, iov, 3) && sane;
+}
+
+// Listen on "host:port" / ":port" (TCP) or a Unix socket path.
+static int listen_on(const std::string& addr, bool& tcp) {
+    size_t colon = addr.rfind(':');
+    tcp = colon != std::string::npos && addr.find('/') == std::string::npos;
+    int fd;
+    if (tcp) {
+        std::string host = addr.substr(0, colon), port = addr.substr(colon + 1);
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo* res = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0 || !res) return -1;
+        fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd >= 0 && ::bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    } else {
+        struct sockaddr_un sa = {};
+        if (addr.size() >= sizeof(sa.sun_path)) return -1;
+        sa.sun_family = AF_UNIX;
+        std::memcpy(sa.sun_path, addr.c_str(), addr.size() + 1);
+        ::unlink(addr.c_str()); // a stale socket from an earlier run
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && ::bind(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0 && ::listen(fd, 128) != 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Every worker accepts on the shared socket and serves one connection at a
+// time with its own buffers. Runs until the process is killed.
+static int run_serve(const std::string& addr, const JobOptions& defaults, unsigned workers) {
+    if (!defaults.base_path.empty() || !defaults.cache_dir.empty() || !defaults.chip_list.empty()) {
+        die("--serve can't be combined with --base, --cache or a --chip list");
+    }
+    bool tcp = false;
+    int lfd = listen_on(addr, tcp);
+    if (lfd < 0) die("--serve: cannot listen on " + addr);
+    std::signal(SIGPIPE, SIG_IGN); // a client hanging up is a failed write, not a crash
+    std::cout << "Serving on " << addr << " with " << workers << " worker(s)" << std::endl;
+
+    auto worker = [&] {
+        ServeBuffers b;
+        for (;;) {
+            int fd = ::accept(lfd, nullptr, nullptr);
+            if (fd < 0) {
+                // Out of descriptors and the like: back off instead of spinning.
+                if (errno != EINTR && errno != ECONNABORTED) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            int one = 1;
+            if (tcp) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            struct timeval idle = {SERVE_IDLE_S, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+            while (serve_request(fd, defaults, b)) {
+            }
+            ::close(fd);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned k = 1; k < workers; ++k) pool.emplace_back(worker);
+    worker();
+    return 0;
+}
+#else
+static int run_serve(const std::string&, const JobOptions&, unsigned) {
+    die("--serve is not available on this platform");
+    return 1;
+}
+#endif
+
+// Preprocess an openMSX softwaredb.xml into the sorted index --db maps.
+static int run_build_db(const std::string& xml_path, const std::vector<std::string>& positional) {
+    if (positional.size() != 1) die("--build-db takes exactly one output index file");
+    std::string err;
+    std::vector<uint8_t> xml;
+    if (!read_file(xml_path, xml, err)) die(err);
+    std::vector<uint8_t> index = rom2msx::build_db_index(std::string(xml.begin(), xml.end()));
+    if (!write_file(positional[0], index.data(), index.size(), err)) die(err);
+    std::cout << "Index: " << (index.size() - rom2msx::DB_HEADER_SIZE) / sizeof(rom2msx::DbRecord) << " ROMs from " << xml_path
+              << " -> " << positional[0] << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " input.rom output.bin [--chip 64|128|...|8192|list|all] [--type mega|rc755|s64k|auto] [--addr 0..7] [--watch] [--sync 1]\n";
+        std::cerr << "       " << argv[0] << " --batch manifest.txt|dir|archive.zip [--jobs N] [--queue-depth N] [--out-dir dir] [--sync N] [options]\n";
+        std::cerr << "       (either form: [--burn devices.txt [--burn-retries N]] to program the images)\n";
+        std::cerr << "       " << argv[0] << " --pack output.bin a.rom b.rom[@addr] ... [--dedup] [--sync 1] [options]\n";
+        std::cerr << "       " << argv[0] << " --plan a.rom b.rom ...|--batch source [--chip list|all] [options]\n";
+        std::cerr << "       " << argv[0] << " input.rom --verify-dump readback.bin [options]\n";
+        std::cerr << "       " << argv[0] << " --audit dir [--jobs N] [--type ...] [--addr 0..7]\n";
+        std::cerr << "       " << argv[0] << " --build-db softwaredb.xml index.r2mi\n";
+        std::cerr << "       " << argv[0] << " --serve socket_path|[host]:port [--jobs N] [options]\n";
+        std::cerr << "Defaults: --chip 128 (SST39SF010), --type mega\n";
+        return 1;
+    }
+
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> positional;
+    JobOptions opt;
+    std::string batch, pack, build_db, serve, audit, verify_dump, burn, out_dir;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    unsigned depth = 8; // --queue-depth: batch inputs read ahead of the workers
+    bool dedup = false; // --pack --dedup
+    bool watch = false; // --watch: convert again whenever the input changes
+    bool plan = false;  // --plan: print where the ROMs would go, convert nothing
+    unsigned retries = 1; // --burn-retries: extra attempts per device
+    unsigned sync_every = 0; // --sync: outputs made durable in groups of this many jobs
+    StatsMode stats = StatsMode::None;
+
+    // Parse options
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& a = args[i];
+        std::string err;
+        if (a.size() < 2 || a.compare(0, 2, "--") != 0) {
+            positional.push_back(a);
+        } else if (a == "--batch") {
+            if (i + 1 >= args.size()) die("--batch requires a manifest file or directory");
+            batch = args[++i];
+        } else if (a == "--pack") {
+            if (i + 1 >= args.size()) die("--pack requires an output file");
+            pack = args[++i];
+        } else if (a == "--verify-dump") {
+            if (i + 1 >= args.size()) die("--verify-dump requires a readback file");
+            verify_dump = args[++i];
+        } else if (a == "--audit") {
+            if (i + 1 >= args.size()) die("--audit requires a directory");
+            audit = args[++i];
+        } else if (a == "--serve") {
+            if (i + 1 >= args.size()) die("--serve requires a socket path or [host]:port");
+            serve = args[++i];
+        } else if (a == "--build-db") {
+            if (i + 1 >= args.size()) die("--build-db requires a softwaredb.xml file");
+            build_db = args[++i];
+        } else if (a == "--jobs") {
+            if (i + 1 >= args.size()) die("--jobs requires a value");
+            int n = std::atoi(args[++i].c_str());
+            if (n < 1) die("--jobs must be at least 1");
+            workers = static_cast<unsigned>(n);
+        } else if (a == "--queue-depth") {
+            if (i + 1 >= args.size()) die("--queue-depth requires a value");
+            int n = std::atoi(args[++i].c_str());
+            if (n < 0 || n > 4096) die("--queue-depth must be 0..4096");
+            depth = static_cast<unsigned>(n);
+        } else if (a == "--sync") {
+            if (i + 1 >= args.size()) die("--sync requires a value");
+            int n = std::atoi(args[++i].c_str());
+            if (n < 1 || n > 65536) die("--sync must be 1..65536");
+            sync_every = static_cast<unsigned>(n);
+        } else if (a == "--dedup") {
+            dedup = true;
+        } else if (a == "--watch") {
+            watch = true;
+        } else if (a == "--plan") {
+            plan = true;
+        } else if (a == "--burn") {
+            if (i + 1 >= args.size()) die("--burn requires a devices file");
+            burn = args[++i];
+        } else if (a == "--burn-retries") {
+            if (i + 1 >= args.size()) die("--burn-retries requires a value");
+            int n = std::atoi(args[++i].c_str());
+            if (n < 0 || n > 100) die("--burn-retries must be 0..100");
+            retries = static_cast<unsigned>(n);
+        } else if (a == "--stats" || a == "--stats=text") {
+            stats = StatsMode::Text;
+        } else if (a == "--stats=json") {
+            stats = StatsMode::Json;
+        } else if (a == "--out-dir") {
+            if (i + 1 >= args.size()) die("--out-dir requires a directory");
+            out_dir = args[++i];
+        } else if (!parse_option(args, i, opt, err)) {
+            die(err);
+        }
+    }
+
+    std::vector<Burner> burners;
+    if (!burn.empty()) {
+        std::string err;
+        if (!build_db.empty() || !serve.empty() || !audit.empty() || !pack.empty() || !verify_dump.empty()) {
+            die("--burn only applies to single conversions and --batch");
+        }
+        if (!load_burners(burn, burners, err)) die(err);
+    }
+    if (sync_every && (!build_db.empty() || !serve.empty() || !audit.empty() || !verify_dump.empty() || plan ||
+                       watch)) {
+        die("--sync only applies to single conversions, --batch and --pack");
+    }
+    if (watch && (!build_db.empty() || !serve.empty() || !audit.empty() || !batch.empty() || !pack.empty() ||
+                  !verify_dump.empty())) {
+        die("--watch only applies to single conversions");
+    }
+    if (plan) {
+        if (!build_db.empty() || !serve.empty() || !audit.empty() || !pack.empty() || !verify_dump.empty() ||
+            !burn.empty() || watch) {
+            die("--plan only applies to input files or --batch");
+        }
+        std::vector<Job> jobs;
+        if (!batch.empty()) {
+            if (!positional.empty()) die("--batch takes no input/output arguments");
+            jobs = load_jobs(batch, out_dir, opt);
+        }
+        for (const auto& in : positional) jobs.push_back(Job{in, std::string(), opt});
+        if (jobs.empty()) die("--plan requires input files or --batch");
+        return run_plan(jobs);
+    }
+    if (!build_db.empty()) return run_build_db(build_db, positional);
+    if (!serve.empty()) {
+        if (!positional.empty()) die("--serve takes no input/output arguments");
+        return run_serve(serve, opt, workers);
+    }
+    if (!audit.empty()) {
+        if (!positional.empty()) die("--audit takes no input/output arguments");
+        return run_audit(audit, opt, workers);
+    }
+    if (!batch.empty()) {
+        if (!positional.empty()) die("--batch takes no input/output arguments");
+        return run_batch(batch, out_dir, opt, workers, depth, sync_every, stats, burners, retries);
+    }
+    if (dedup && pack.empty()) die("--dedup only applies to --pack");
+    if (!pack.empty()) return run_pack(pack, positional, opt, dedup, sync_every != 0);
+    if (!verify_dump.empty()) {
+        if (positional.size() != 1) die("--verify-dump takes exactly one input file and no output");
+        return run_verify_dump(positional[0], verify_dump, opt);
+    }
+    if (positional.size() != 2) die("Expected exactly one input and one output file");
+
+    // With the image going to stdout, the report goes to stderr.
+    Job job{positional[0], positional[1], opt};
+    if (watch) return run_watch(job, stats, burners, retries);
+    std::ostream& info = job.out_path == "-" ? std::cerr : std::cout;
+    std::string report, err;
+    Stats st;
+    Arena arena;
+    if (!burners.empty() && (job.out_path == "-" || !opt.chip_list.empty())) {
+        die("--burn can't be combined with \"-\" (stdout) or a --chip list");
+    }
+    // --sync: the image (and its cache entry) is flushed before it replaces
+    // the output, a group of one.
+    std::vector<Staged> staged;
+    bool converted = convert(job, report, err, st, arena, false, sync_every ? &staged : nullptr);
+    if (converted && sync_every) converted = commit_job(staged, true, err);
+    else if (!converted) discard_staged(staged);
+    if (stats == StatsMode::Json) info << job_json(job, converted, err, st) << "\n";
+    if (!converted) die(err);
+    bool burned = true;
+    if (!burners.empty()) {
+        BurnLine line(burners, retries, 1, sync_every != 0);
+        line.push(0, job.out_path, opt.format == Format::Bin);
+        std::string note;
+        burned = burn_note(line.finish()[0], note);
+        report += note;
+    }
+    info << report << "\n";
+    if (stats == StatsMode::Text) info << "Stats: " << format_stats(st, stats) << "\n";
+    return burned ? 0 : 1;
+}
@@ -0,0 +1,423 @@
+// rom2msx.hpp
+// Conversion library behind the rom2msx tool (librom2msx.a).
+//
+// Everything here works on caller-provided memory: convert() lays a ROM out
+// in an output buffer the caller owns, without allocating, and every failure
+// is returned as a Status instead of ending the process. One output buffer
+// (sized to the largest chip in use) can be reused for any number of
+// conversions.
+//
+//   rom2msx::Options opt;                 // --type / --chip / --addr
+//   opt.type = rom2msx::CartType::Simple64K;
+//   std::vector<uint8_t> out(opt.chip_bytes());
+//   rom2msx::Placement p;
+//   rom2msx::Status s = rom2msx::convert(rom, opt, out, &p);
+//   if (s != rom2msx::Status::Ok) log(rom2msx::status_message(s));
+//
+// The mapping rules are the ones documented in rom2msx.cpp (and README.md).
+//
+// License: MIT (to align with upstream's permissive license intention).
+
+#ifndef ROM2MSX_HPP
+#define ROM2MSX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace rom2msx {
+
+constexpr size_t BANK_SIZE = 0x2000;   // 8 KiB
+constexpr size_t SECTOR_SIZE = 0x1000; // 4 KiB, the SST39SF0x0 erase unit
+
+// Non-owning view of a contiguous range, a C++17 stand-in for std::span.
+template <class T>
+class span {
+public:
+    constexpr span() = default;
+    constexpr span(T* data, size_t size) : data_(data), size_(size) {}
+    // Any contiguous container (std::vector, std::array, std::string, ...).
+    template <class C, class = decltype(std::declval<C&>().data()),
+              class = std::enable_if_t<std::is_convertible<decltype(std::declval<C&>().data()), T*>::value>>
+    constexpr span(C& c) : data_(c.data()), size_(c.size()) {}
+    // span<T> -> span<const T>
+    template <class U, class = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+    constexpr span(span<U> s) : data_(s.data()), size_(s.size()) {}
+
+    constexpr T* data() const { return data_; }
+    constexpr size_t size() const { return size_; }
+    constexpr bool empty() const { return size_ == 0; }
+    constexpr T* begin() const { return data_; }
+    constexpr T* end() const { return data_ + size_; }
+    constexpr T& operator[](size_t i) const { return data_[i]; }
+    constexpr span first(size_t n) const { return span(data_, n); }
+    constexpr span subspan(size_t off, size_t n) const { return span(data_ + off, n); }
+
+private:
+    T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+enum class CartType { MegaSCC, RC755, Simple64K };
+
+constexpr CartType CART_TYPES[] = {CartType::MegaSCC, CartType::RC755, CartType::Simple64K};
+
+// The layout rules of each cart type, one policy per type, fixed at compile
+// time. plan_layout() is written once against these members and instantiated
+// per policy; adding a target means one CartType value, one specialization
+// and one case in with_mapper().
+//   name          type_name()
+//   window_banks  banks the ROM must fit in from bank 0 (0: the whole chip)
+//   bank_align    start banks are multiples of this (the mapper's page size)
+//   movable       Options::s64k_addr may pick the start bank
+//   start_bank()  the start bank otherwise, from the padded size in banks
+template <CartType T>
+struct Mapper;
+
+template <>
+struct Mapper<CartType::MegaSCC> {
+    static constexpr const char* name = "MegaSCC";
+    static constexpr size_t window_banks = 0;
+    static constexpr size_t bank_align = 1;
+    static constexpr bool movable = false;
+    static constexpr size_t start_bank(size_t) { return 0; }
+};
+
+template <>
+struct Mapper<CartType::RC755> {
+    static constexpr const char* name = "RC755";
+    static constexpr size_t window_banks = 0;
+    static constexpr size_t bank_align = 1;
+    static constexpr bool movable = false;
+    static constexpr size_t start_bank(size_t) { return 0; }
+};
+
+template <>
+struct Mapper<CartType::Simple64K> {
+    static constexpr const char* name = "Simple64K";
+    static constexpr size_t window_banks = 8;
+    static constexpr size_t bank_align = 1;
+    static constexpr bool movable = true;
+    // Up to 32 KiB starts at 0x4000 (block 2), larger ROMs at 0x0000.
+    static constexpr size_t start_bank(size_t in_banks) { return in_banks <= 4 ? 2 : 0; }
+};
+
+// Call f with the policy of type (a Mapper<T>{} value): the one switch on
+// CartType, outside any per-bank loop.
+template <class F>
+constexpr decltype(auto) with_mapper(CartType type, F&& f) {
+    switch (type) {
+        case CartType::RC755:     return f(Mapper<CartType::RC755>{});
+        case CartType::Simple64K: return f(Mapper<CartType::Simple64K>{});
+        case CartType::MegaSCC:   break;
+    }
+    return f(Mapper<CartType::MegaSCC>{});
+}
+
+// A policy's constants as a value, for code that only has the CartType at
+// run time (--plan, bench, --pack).
+struct MapperInfo {
+    const char* name;
+    size_t window_banks;
+    size_t bank_align;
+    bool movable;
+};
+
+constexpr MapperInfo mapper_info(CartType type) {
+    return with_mapper(type, [](auto m) {
+        using M = decltype(m);
+        return MapperInfo{M::name, M::window_banks, M::bank_align, M::movable};
+    });
+}
+
+const char* type_name(CartType type);
+
+// The layout options of one conversion.
+struct Options {
+    int chip_kib = 128; // default SST39SF010; up to 8192 for 29F0x0 / S29GL parts
+    CartType type = CartType::MegaSCC;
+    int s64k_addr = -1; // optional start block
+
+    size_t chip_bytes() const { return static_cast<size_t>(chip_kib) * 1024ULL; }
+};
+
+// Chip sizes (KiB) the converter supports: the powers of two from 64 to 8192.
+bool valid_chip_kib(int kib);
+
+enum class Status {
+    Ok,
+    BadChipSize,         // Options::chip_kib is not a supported size
+    BadAddr,             // Options::s64k_addr is not -1 or 0..7
+    RomTooLargeForS64K,  // more than 8 banks for Simple64K
+    AddrExceedsWindow,   // s64k_addr + banks > 8
+    AutoStartNoFit,      // Simple64K auto start bank doesn't fit
+    RomLargerThanChip,   // padded ROM exceeds the chip
+    PlacementOverflow,   // a bank would land past the end of the image
+    OutputTooSmall,      // output buffer smaller than the chip
+    VerifySizeMismatch,  // image shorter than the placements need
+    VerifyBankMismatch,  // a written bank differs from the ROM
+    VerifyNotBlank,      // non-0xFF byte outside the written banks
+    MapperUnknown,       // detect_mapper() found no bank switching in a megaROM
+    MapperUnsupported,   // the detected mapper isn't one the carts provide
+    ArchiveBad,          // no zip central directory, or a record runs past the end
+    ArchiveUnsupported,  // ZIP64, encrypted, or neither stored nor deflated
+    InflateError,        // malformed deflate stream
+    ArchiveCrcMismatch,  // member contents don't match their CRC-32
+    NotTranslatable,     // translate_mapper() only handles Konami and ASCII8
+};
+
+// Human-readable description of a status (static storage).
+const char* status_message(Status s);
+
+// Where one ROM sits in the chip image.
+struct Placement {
+    const uint8_t* rom = nullptr;
+    size_t rom_bytes = 0;  // unpadded size
+    size_t in_banks = 0;   // size after 8 KiB padding, in banks
+    size_t start_bank = 0;
+};
+
+// Resolve the placement of a rom_bytes-sized ROM per the mapping rules
+// (rom is left unset).
+Status plan_layout(const Options& opt, size_t rom_bytes, Placement& p);
+
+// Copy the ROM's banks into an image that is already 0xFF-filled; the tail of
+// a partial last bank is left untouched.
+Status place_banks(span<uint8_t> img, const Placement& p);
+
+class ImageChecksum;
+
+// Lay rom out in out[0, opt.chip_bytes()): the banks are placed and only the
+// gaps around them are filled with 0xFF, so every byte is stored once. out
+// may be larger than the chip; the rest of it is left alone. Optionally
+// returns the resolved placement, and adds the image to sums bank by bank as
+// it is placed (the fill without reading it back).
+Status convert(span<const uint8_t> rom, const Options& opt, span<uint8_t> out, Placement* placed = nullptr,
+               ImageChecksum* sums = nullptr);
+
+// Check an image in one pass: every written bank against its ROM (the padding
+// tail against 0xFF) and every gap between them against 0xFF. Placements must
+// be ordered by start bank and must not overlap. On VerifyBankMismatch,
+// *bad_bank (if given) is the failing bank of that ROM.
+Status verify(span<const uint8_t> img, const Placement* pl, size_t count, size_t* bad_bank = nullptr);
+
+// The mapper a ROM was written for, as seen from its bank-switch writes.
+enum class RomMapper { None, Konami, KonamiSCC, ASCII8, ASCII16, Other };
+
+const char* mapper_name(RomMapper m);
+
+struct MapperGuess {
+    RomMapper mapper = RomMapper::None;
+    unsigned hits = 0;       // LD (nnnn),A to any bank-switch address
+    unsigned score = 0;      // of those, the ones voting for mapper
+    unsigned confidence = 0; // percent: score / hits (100 for plain ROMs)
+};
+
+// Guess the mapper of a ROM by scanning it for Z80 LD (nnnn),A (0x32 nn nn)
+// writes to the bank-switch addresses of Konami, Konami SCC, ASCII8 and
+// ASCII16, and scoring the hits. ROMs up to 32 KiB, and 64 KiB ones without
+// clear bank switching, are plain (RomMapper::None).
+MapperGuess detect_mapper(span<const uint8_t> rom);
+
+// The cart type a detected mapper is burned as: MegaSCC for Konami SCC,
+// Simple64K for plain ROMs. MapperUnknown / MapperUnsupported otherwise.
+// (A plain ROM over 64 KiB only comes from detect_mapper finding nothing.)
+Status type_for_mapper(const MapperGuess& g, size_t rom_bytes, CartType& type);
+
+// One bank-switch write rewritten by translate_mapper().
+struct MapperPatch {
+    size_t offset = 0; // of the (little-endian) address operand in the ROM
+    uint16_t from = 0; // register address as found
+    uint16_t to = 0;   // the Konami SCC register written instead
+};
+
+// Rewrite the bank-switch writes of a Konami or ASCII8 ROM, in place, to the
+// Konami SCC registers at 0x5000/0x7000/0x9000/0xB000 that MegaSCC carts
+// decode. Both mappers switch 8 KiB banks, so every rewritten write selects
+// the same bank in the same page as before. The ROM is decoded in one linear
+// pass with a Z80 instruction-length table (so operands are never taken for
+// opcodes); LD (nnnn),A and LD HL,nnnn directly followed by LD (HL),r are
+// patched and logged. Writes through an address computed at run time can't
+// be seen this way and are left alone. ASCII16 (16 KiB banks, two SCC
+// registers per switch) and the other mappers are NotTranslatable.
+Status translate_mapper(span<uint8_t> rom, RomMapper from, std::vector<MapperPatch>& log);
+
+// ROM database index ("R2MI"): an openMSX softwaredb.xml reduced to SHA-1 ->
+// mapper (and start address) records sorted by hash, so it can be mapped and
+// searched as is. Layout: "R2MI", version byte (1), 3 reserved bytes, the
+// record count (32-bit little-endian), then 24-byte records: SHA-1 (20),
+// RomMapper (1), start block (1, 0xFF = none), 2 reserved.
+constexpr size_t DB_HEADER_SIZE = 12;
+
+struct DbRecord {
+    uint8_t sha1[20];
+    uint8_t mapper;
+    uint8_t start_block;
+    uint8_t reserved[2];
+};
+static_assert(sizeof(DbRecord) == 24, "DbRecord must match the index layout");
+
+// Build the index from softwaredb.xml text: every <rom>/<megarom> dump with a
+// SHA-1 <hash> becomes a record; <type> names the mapper (unknown ones are
+// RomMapper::Other) and <start> the load address. Duplicate hashes keep the
+// first dump.
+std::vector<uint8_t> build_db_index(const std::string& xml);
+
+// True if index has the R2MI header and holds all the records it declares.
+bool db_index_valid(span<const uint8_t> index);
+
+// Look a SHA-1 up in an index; nullptr if it isn't there or the index is
+// malformed.
+const DbRecord* db_lookup(span<const uint8_t> index, const uint8_t sha1[20]);
+
+// CRC-32 as used by zip (IEEE 802.3); pass the previous value to continue.
+uint32_t crc32(const uint8_t* p, size_t n, uint32_t crc = 0);
+
+// Decompress a raw deflate stream (RFC 1951) into out; *produced gets the
+// decompressed size. Output that wouldn't fit in out is an InflateError.
+Status inflate(span<const uint8_t> in, span<uint8_t> out, size_t* produced = nullptr);
+
+// One file of a zip archive, from its central directory record.
+struct ZipEntry {
+    std::string name;
+    uint16_t flags = 0;
+    uint16_t method = 0; // 0 stored, 8 deflated
+    uint32_t crc32 = 0;
+    size_t comp_size = 0;
+    size_t size = 0;
+    size_t local_offset = 0;
+};
+
+// List the files (not directories) of a zip archive held in memory.
+Status zip_list(span<const uint8_t> zip, std::vector<ZipEntry>& entries);
+
+// A member's contents, CRC-checked: stored members are returned as a view
+// into zip, deflated ones are inflated into buf (data then views buf).
+Status zip_read(span<const uint8_t> zip, const ZipEntry& e, std::vector<uint8_t>& buf, span<const uint8_t>& data);
+
+// Windowed forms of convert() and verify() for images too large to keep in
+// memory: win holds image bytes [offset, offset + win.size()). Placements
+// must be ordered by start bank and must not overlap.
+
+// Store the image bytes of the window: the ROMs' data where a placement
+// covers it, 0xFF everywhere else. With sums, the window is also added to
+// them (so windows must then be rendered front to back).
+void render_window(span<uint8_t> win, size_t offset, const Placement* pl, size_t count,
+                   ImageChecksum* sums = nullptr);
+
+// verify() restricted to one window; the caller checks that the image is
+// large enough for the placements.
+Status verify_window(span<const uint8_t> win, size_t offset, const Placement* pl, size_t count,
+                     size_t* bad_bank = nullptr);
+
+// True if all n bytes at p are 0xFF (erased).
+bool all_ff(const uint8_t* p, size_t n);
+
+// SHA-1 (FIPS 180-1).
+class Sha1 {
+public:
+    void update(const uint8_t* p, size_t n);
+    void final(uint8_t digest[20]);
+    std::string hex(); // final() as 40 lowercase hex digits
+
+private:
+    void compress(const uint8_t* b);
+
+    uint32_t h_[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block_[64];
+    size_t used_ = 0;
+    uint64_t total_ = 0;
+};
+
+// The checksums an image is identified by: CRC-32 and SHA-1 (as crc32 and
+// sha1sum print them) and the 16-bit additive sum device programmers show.
+// Bytes are added front to back; fill() adds a run of 0xFF without any
+// memory behind it (CRC-32 and sum in closed form, SHA-1 from a shared blank
+// block).
+class ImageChecksum {
+public:
+    void data(const uint8_t* p, size_t n);
+    void fill(size_t n);
+
+    uint32_t crc32() const { return crc_; }
+    uint16_t sum16() const { return static_cast<uint16_t>(sum_); }
+    std::string sha1() const {
+        Sha1 s = sha_;
+        return s.hex();
+    }
+
+private:
+    uint32_t crc_ = 0;
+    uint64_t sum_ = 0;
+    Sha1 sha_;
+};
+
+// The checksums of a chip_bytes image holding the given placements (ordered
+// by start bank, not overlapping), from the ROM bytes alone.
+void checksum_image(ImageChecksum& sums, size_t chip_bytes, const Placement* pl, size_t count);
+
+// A run of non-0xFF bytes at [off, off + len).
+struct Range {
+    size_t off;
+    size_t len;
+};
+
+// Find the non-0xFF ranges of an image. Blank stretches shorter than
+// merge_gap are kept inside a range, since describing them costs more than
+// the bytes themselves.
+std::vector<Range> find_ranges(span<const uint8_t> img, size_t merge_gap);
+
+// Sparse encodings of the given ranges of img (see README.md for layouts).
+std::string encode_ihex(span<const uint8_t> img, const std::vector<Range>& ranges);
+std::string encode_srec(span<const uint8_t> img, const std::vector<Range>& ranges);
+std::vector<uint8_t> encode_ranges(span<const uint8_t> img, const std::vector<Range>& ranges);
+
+// Indices of the SECTOR_SIZE sectors in which img and base (same size) differ.
+std::vector<size_t> changed_sectors(span<const uint8_t> img, span<const uint8_t> base);
+
+// The "R2MD" sector delta container holding the given sectors of img.
+std::vector<uint8_t> encode_delta(span<const uint8_t> img, const std::vector<size_t>& sectors);
+
+// A SECTOR_SIZE sector in which a chip readback differs from its image.
+// Bits that rose read 1 where the image has 0 (not programmed, or stuck at
+// 1); bits that fell read 0 where it has 1 (not erased, or stuck at 0).
+struct SectorDiff {
+    size_t sector = 0;
+    size_t bytes = 0; // bytes that differ
+    size_t rose = 0;
+    size_t fell = 0;
+};
+
+// Readback comparison: the sectors that differ, in order, plus the totals
+// and the flipped bits per data line (D0..D7).
+struct DumpDiff {
+    std::vector<SectorDiff> sectors;
+    size_t bytes = 0;
+    size_t rose = 0;
+    size_t fell = 0;
+    size_t line_rose[8] = {};
+    size_t line_fell[8] = {};
+};
+
+// Compare a chip readback with the image it should hold. Identical stretches
+// are skipped 64 bytes at a time; only differing words are examined bit by
+// bit. VerifySizeMismatch (and an empty diff) if the sizes differ.
+Status diff_dump(span<const uint8_t> img, span<const uint8_t> dump, DumpDiff& diff);
+
+// Bank-level deduplication across ROMs: every 8 KiB bank of every ROM (the
+// last one 0xFF-padded), with identical banks stored once. unique gets one
+// single-bank placement per distinct bank, on consecutive chip banks in order
+// of first appearance; maps[r][i] is the chip bank holding bank i of roms[r].
+// Banks are looked up by CRC-32 and confirmed byte for byte.
+void dedup_banks(const std::vector<span<const uint8_t>>& roms, std::vector<Placement>& unique,
+                 std::vector<std::vector<size_t>>& maps);
+
+// The "R2MB" bank map container for a menu loader: per ROM, the chip bank of
+// each of its banks (see README.md for the layout).
+std::vector<uint8_t> encode_bank_map(const std::vector<std::vector<size_t>>& maps);
+
+} // namespace rom2msx
+
+#endif // ROM2MSX_HPP
@@ -0,0 +1,510 @@
+// rom2msx_io.cpp
+// File I/O of the rom2msx tool; see rom2msx_io.hpp.
+
+#include "rom2msx_io.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+#ifdef ROM2MSX_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+namespace rom2msx {
+namespace io {
+
+bool ok(Status s, std::string& err) {
+    if (s == Status::Ok) return true;
+    err = status_message(s);
+    return false;
+}
+
+bool verified(Status s, size_t bad_bank, std::string& err) {
+    if (s == Status::Ok) return true;
+    err = std::string("--verify: ") + status_message(s);
+    if (s == Status::VerifyBankMismatch) err += " " + std::to_string(bad_bank);
+    return false;
+}
+
+bool read_file(const std::string& path, std::vector<uint8_t>& buf, std::string& err) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) { err = "Cannot open input file: " + path; return false; }
+    f.seekg(0, std::ios::end);
+    std::streamoff len = f.tellg();
+    if (len < 0) { err = "tellg failed for input file"; return false; }
+    f.seekg(0, std::ios::beg);
+    buf.resize(static_cast<size_t>(len));
+    if (len > 0) {
+        f.read(reinterpret_cast<char*>(buf.data()), len);
+        if (!f) { err = "Failed to read input file fully"; return false; }
+    }
+    return true;
+}
+
+std::string staging_name(const std::string& path) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    auto st = fs::symlink_status(path, ec);
+    if (fs::exists(st) && !fs::is_regular_file(st)) return path;
+    static std::atomic<unsigned> seq{0};
+#ifndef _WIN32
+    long pid = static_cast<long>(getpid());
+#else
+    long pid = static_cast<long>(_getpid());
+#endif
+    fs::path p(path);
+    std::string name = "." + p.filename().string() + ".tmp" + std::to_string(pid) + "-" + std::to_string(seq++);
+    return (p.parent_path() / name).string();
+}
+
+StagedFile::~StagedFile() {
+    std::error_code ec;
+    if (!done_ && tmp_ != path_) std::filesystem::remove(tmp_, ec);
+}
+
+bool StagedFile::publish(std::vector<Staged>* staged, std::string& err) {
+    done_ = true;
+    if (tmp_ == path_) return true;
+    if (staged) {
+        staged->push_back(Staged{tmp_, path_});
+        return true;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_, path_, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_, ec);
+        err = "Cannot replace output file: " + path_;
+        return false;
+    }
+    return true;
+}
+
+void discard_staged(const std::vector<Staged>& files, size_t from) {
+    std::error_code ec;
+    for (size_t k = from; k < files.size(); ++k) {
+        if (!files[k].tmp.empty()) std::filesystem::remove(files[k].tmp, ec);
+    }
+}
+
+void commit_staged(const std::vector<Staged>& files, bool durable, std::map<size_t, std::string>& failed) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    std::vector<std::string> dirs;
+    std::vector<size_t> dir_of(files.size());
+    for (size_t k = 0; k < files.size(); ++k) {
+        std::string dir = fs::path(files[k].path).parent_path().string();
+        if (dir.empty()) dir = ".";
+        auto it = std::find(dirs.begin(), dirs.end(), dir);
+        dir_of[k] = static_cast<size_t>(it - dirs.begin());
+        if (it == dirs.end()) dirs.push_back(dir);
+    }
+    auto fail_all = [&](const std::string& err) {
+        for (const auto& f : files) failed.emplace(f.job, err + "; nothing replaced");
+        discard_staged(files);
+    };
+#ifndef _WIN32
+    std::vector<int> dir_fds;
+    struct Closer {
+        std::vector<int>& fds;
+        ~Closer() { for (int fd : fds) ::close(fd); }
+    } closer{dir_fds};
+    if (durable) {
+        for (const auto& dir : dirs) {
+            int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0) return fail_all("Cannot open output directory: " + dir);
+            dir_fds.push_back(fd);
+        }
+#ifdef __linux__
+        std::vector<dev_t> devs;
+        for (size_t k = 0; k < dir_fds.size(); ++k) {
+            struct stat st;
+            if (fstat(dir_fds[k], &st) != 0) return fail_all("Cannot open output directory: " + dirs[k]);
+            if (std::find(devs.begin(), devs.end(), st.st_dev) != devs.end()) continue;
+            devs.push_back(st.st_dev);
+            if (syncfs(dir_fds[k]) != 0) return fail_all("Failed to sync output files in " + dirs[k]);
+        }
+#else
+        for (const auto& f : files) {
+            if (f.tmp.empty()) continue;
+            int fd = ::open(f.tmp.c_str(), O_RDONLY);
+            bool synced = fd >= 0 && fsync(fd) == 0;
+            if (fd >= 0) ::close(fd);
+            if (!synced) return fail_all("Failed to sync output file: " + f.path);
+        }
+#endif
+    }
+#else
+    (void)durable;
+#endif
+    std::map<size_t, size_t> replaced; // per job
+    std::vector<bool> touched(dirs.size(), false);
+    for (size_t k = 0; k < files.size(); ++k) {
+        const Staged& f = files[k];
+        if (failed.count(f.job)) {
+            if (!f.tmp.empty()) fs::remove(f.tmp, ec);
+            continue;
+        }
+        if (f.tmp.empty()) {
+            fs::remove(f.path, ec);
+        } else {
+            fs::rename(f.tmp, f.path, ec);
+            if (ec) {
+                size_t n = replaced[f.job];
+                failed.emplace(f.job, "Cannot replace output file: " + f.path +
+                                          (n ? "; " + std::to_string(n) + " of the job's other outputs were replaced"
+                                             : std::string("; nothing replaced")));
+                fs::remove(f.tmp, ec);
+                continue;
+            }
+        }
+        ++replaced[f.job];
+        touched[dir_of[k]] = true;
+    }
+#ifndef _WIN32
+    for (size_t d = 0; d < dir_fds.size(); ++d) {
+        if (!touched[d] || fsync(dir_fds[d]) == 0) continue;
+        for (size_t k = 0; k < files.size(); ++k) {
+            if (dir_of[k] == d && !failed.count(files[k].job)) {
+                failed.emplace(files[k].job, "Failed to sync output directory: " + dirs[d] +
+                                                 "; outputs replaced, but they may not survive a crash");
+            }
+        }
+    }
+#endif
+}
+
+bool commit_job(const std::vector<Staged>& files, bool durable, std::string& err) {
+    std::map<size_t, std::string> failed;
+    commit_staged(files, durable, failed);
+    if (failed.empty()) return true;
+    err = failed.begin()->second;
+    return false;
+}
+
+bool put_file(const std::string& path, const uint8_t* data, size_t len, std::string& err) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) { err = "Cannot open output file: " + path; return false; }
+    f.write(reinterpret_cast<const char*>(data), len);
+    if (!f.flush()) { err = "Failed to write output file"; return false; }
+    return true;
+}
+
+bool write_file(const std::string& path, const uint8_t* data, size_t len, std::string& err,
+                std::vector<Staged>* staged) {
+    StagedFile out(path);
+    return put_file(out.tmp(), data, len, err) && out.publish(staged, err);
+}
+
+InputFile::~InputFile() {
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+bool InputFile::open(const std::string& path, std::string& err) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { err = "Cannot open input file: " + path; return false; }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<const uint8_t*>(p);
+            size_ = static_cast<size_t>(st.st_size);
+            mapped_ = true;
+        }
+    }
+    ::close(fd);
+    if (mapped_) return true;
+#endif
+    if (!read_file(path, buf_, err)) return false;
+    data_ = buf_.data();
+    size_ = buf_.size();
+    return true;
+}
+
+OutputFile::~OutputFile() {
+#ifndef _WIN32
+    if (mapped_) munmap(data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+bool OutputFile::create(const std::string& path, size_t size, bool map, std::string& err,
+                        std::vector<uint8_t>* buf) {
+    path_ = path;
+    size_ = size;
+#ifndef _WIN32
+    if (map && !map_file(err)) return false;
+    if (mapped_) return true;
+#else
+    (void)map;
+#endif
+    if (buf) buf_ = buf;
+    buf_->resize(size);
+    data_ = buf_->data();
+    return true;
+}
+
+bool OutputFile::commit(std::string& err) {
+#ifndef _WIN32
+    if (mapped_) {
+        mapped_ = false;
+        if (munmap(data_, size_) != 0) { err = "Failed to write output file"; return false; }
+        data_ = nullptr;
+        int rc = ::close(fd_);
+        fd_ = -1;
+        if (rc != 0) { err = "Failed to write output file"; return false; }
+        return true;
+    }
+#endif
+    return put_file(path_, data_, size_, err);
+}
+
+bool OutputFile::map_file(std::string& err) {
+#ifndef _WIN32
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0) { err = "Cannot open output file: " + path_; return false; }
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+            err = "Failed to write output file";
+            return false;
+        }
+        // Reserve the blocks now: running out of space while storing into
+        // a mapping is a SIGBUS, not an error return.
+        int rc = posix_fallocate(fd_, 0, static_cast<off_t>(size_));
+        if (rc != 0 && rc != EOPNOTSUPP && rc != EINVAL) {
+            err = "Failed to write output file";
+            return false;
+        }
+        void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<uint8_t*>(p);
+            mapped_ = true;
+            return true;
+        }
+    }
+    ::close(fd_);
+    fd_ = -1;
+#else
+    (void)err;
+#endif
+    return true;
+}
+
+bool verify_image(const uint8_t* img, size_t img_bytes, const Placement* pl, size_t count,
+                  std::string& err) {
+    size_t bad_bank = 0;
+    return verified(verify(span<const uint8_t>(img, img_bytes), pl, count, &bad_bank), bad_bank, err);
+}
+
+bool verify_file(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count,
+                 std::string& err) {
+    InputFile vf;
+    if (!vf.open(path, err)) {
+        err = "--verify: failed to read output back";
+        return false;
+    }
+    if (vf.size() != chip_bytes) {
+        err = "--verify: output size differs from chip size";
+        return false;
+    }
+    return verify_image(vf.data(), vf.size(), pl, count, err);
+}
+
+bool write_windows(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count, bool verify,
+                   ImageChecksum* sums, std::vector<uint8_t>& win, Stopwatch& sw, Stats& st, std::string& err) {
+    auto close = [](std::FILE* f) { std::fclose(f); };
+    std::unique_ptr<std::FILE, decltype(close)> f(std::fopen(path.c_str(), "wb"), close);
+    if (!f) { err = "Cannot open output file: " + path; return false; }
+    std::setvbuf(f.get(), nullptr, _IONBF, 0); // whole windows go straight to write()
+    static const std::vector<uint8_t> blank(WINDOW_BYTES, 0xFF);
+    if (win.size() < WINDOW_BYTES) win.resize(WINDOW_BYTES);
+    sw.lap(st.write_ns);
+
+    size_t k = 0; // first placement that doesn't end before the window
+    for (size_t off = 0; off < chip_bytes; off += WINDOW_BYTES) {
+        size_t n = std::min(WINDOW_BYTES, chip_bytes - off);
+        while (k < count && (pl[k].start_bank + pl[k].in_banks) * BANK_SIZE <= off) ++k;
+        const uint8_t* data = blank.data();
+        if (k < count && pl[k].start_bank * BANK_SIZE < off + n) {
+            span<uint8_t> w(win.data(), n);
+            render_window(w, off, pl + k, count - k, sums);
+            data = win.data();
+            sw.lap(st.place_ns);
+            if (verify) {
+                size_t bad_bank = 0;
+                if (!verified(verify_window(w, off, pl + k, count - k, &bad_bank), bad_bank, err)) {
+                    return false;
+                }
+                sw.lap(st.verify_ns);
+            }
+        } else if (sums) {
+            sums->fill(n);
+            sw.lap(st.place_ns);
+        }
+        if (std::fwrite(data, 1, n, f.get()) != n) { err = "Failed to write output file"; return false; }
+        sw.lap(st.write_ns);
+    }
+    if (std::fclose(f.release()) != 0) { err = "Failed to write output file"; return false; }
+
+    size_t rom_bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        rom_bytes += pl[i].rom_bytes;
+        st.banks_written += pl[i].in_banks;
+    }
+    st.bytes_filled = chip_bytes - rom_bytes;
+    st.bytes_written = chip_bytes;
+    if (verify) st.bytes_verified = chip_bytes;
+    sw.lap(st.write_ns);
+    return true;
+}
+
+#ifndef _WIN32
+bool write_spans(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count,
+                 ImageChecksum* sums, Stopwatch& sw, Stats& st, std::string& err) {
+    static const std::vector<uint8_t> blank(WINDOW_BYTES, 0xFF);
+    std::vector<iovec> iov;
+    auto add = [&](const uint8_t* p, size_t n) {
+        if (n > 0) iov.push_back(iovec{const_cast<uint8_t*>(p), n});
+    };
+    auto fill = [&](size_t n) {
+        if (sums) sums->fill(n);
+        for (size_t k; n > 0; n -= k) {
+            k = std::min(n, blank.size());
+            add(blank.data(), k);
+        }
+    };
+    size_t pos = 0, rom_bytes = 0;
+    for (size_t k = 0; k < count; ++k) {
+        size_t lo = pl[k].start_bank * BANK_SIZE;
+        fill(lo - pos);
+        add(pl[k].rom, pl[k].rom_bytes);
+        if (sums) sums->data(pl[k].rom, pl[k].rom_bytes);
+        pos = lo + pl[k].rom_bytes;
+        rom_bytes += pl[k].rom_bytes;
+        st.banks_written += pl[k].in_banks;
+    }
+    fill(chip_bytes - pos);
+    st.bytes_filled = chip_bytes - rom_bytes;
+    sw.lap(st.place_ns);
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) { err = "Cannot open output file: " + path; return false; }
+    long max_iov = sysconf(_SC_IOV_MAX);
+    size_t batch = max_iov > 0 ? static_cast<size_t>(max_iov) : 16;
+    for (size_t i = 0; i < iov.size();) {
+        ssize_t n = ::writev(fd, &iov[i], static_cast<int>(std::min(batch, iov.size() - i)));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ::close(fd);
+            err = "Failed to write output file";
+            return false;
+        }
+        // Skip what was written; a short write resumes inside an iovec.
+        for (size_t done = static_cast<size_t>(n); done > 0;) {
+            size_t k = std::min(done, iov[i].iov_len);
+            iov[i].iov_base = static_cast<uint8_t*>(iov[i].iov_base) + k;
+            iov[i].iov_len -= k;
+            done -= k;
+            if (iov[i].iov_len == 0) ++i;
+        }
+    }
+    if (::close(fd) != 0) { err = "Failed to write output file"; return false; }
+    st.bytes_written = chip_bytes;
+    sw.lap(st.write_ns);
+    return true;
+}
+#endif
+
+#ifdef ROM2MSX_IO_URING
+Ring::~Ring() {
+    if (sqes_) munmap(sqes_, sqes_len_);
+    if (cq_) munmap(cq_, cq_len_);
+    if (sq_) munmap(sq_, sq_len_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool Ring::init(unsigned entries) {
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) return false;
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    int prot = PROT_READ | PROT_WRITE, flags = MAP_SHARED | MAP_POPULATE;
+    sq_ = mmap(nullptr, sq_len_, prot, flags, fd_, IORING_OFF_SQ_RING);
+    cq_ = mmap(nullptr, cq_len_, prot, flags, fd_, IORING_OFF_CQ_RING);
+    sqes_ = mmap(nullptr, sqes_len_, prot, flags, fd_, IORING_OFF_SQES);
+    // Whatever didn't map stays null, for the destructor.
+    for (void** m : {&sq_, &cq_, &sqes_}) {
+        if (*m == MAP_FAILED) *m = nullptr;
+    }
+    if (!sq_ || !cq_ || !sqes_) return false;
+    auto* sq = static_cast<char*>(sq_);
+    auto* cq = static_cast<char*>(cq_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool Ring::read(int fd, uint8_t* buf, size_t len, size_t off, uint64_t tag) {
+    unsigned tail = *sq_tail_;
+    unsigned idx = tail & sq_mask_;
+    struct io_uring_sqe& e = static_cast<struct io_uring_sqe*>(sqes_)[idx];
+    std::memset(&e, 0, sizeof(e));
+    e.opcode = IORING_OP_READ;
+    e.fd = fd;
+    e.addr = reinterpret_cast<uint64_t>(buf);
+    e.len = static_cast<unsigned>(std::min<size_t>(len, 1u << 30));
+    e.off = off;
+    e.user_data = tag;
+    sq_array_[idx] = idx;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0) == 1;
+}
+
+bool Ring::wait(uint64_t& tag, int& res) {
+    for (;;) {
+        unsigned head = *cq_head_;
+        if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe& c = cqes_[head & cq_mask_];
+            tag = c.user_data;
+            res = c.res;
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
+#endif
+
+} // namespace io
+} // namespace rom2msx
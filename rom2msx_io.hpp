@@ -0,0 +1,288 @@
+// rom2msx_io.hpp
+// File I/O of the rom2msx tool (rom2msx_io.o): mapped inputs and outputs,
+// staged (atomically replaced) outputs and their group commits, the raw
+// image writers and the file-level verify, plus the phase timings they
+// charge. Shared by the command line tool and rom2msx_bench.
+//
+// Unlike librom2msx, these report failures as bool + error text, the way the
+// tool prints them, and POSIX is assumed where there is a faster path than
+// the standard library's.
+
+#ifndef ROM2MSX_IO_HPP
+#define ROM2MSX_IO_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rom2msx.hpp"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup)
+#define ROM2MSX_IO_URING 1
+#endif
+#endif
+
+struct io_uring_cqe;
+
+namespace rom2msx {
+namespace io {
+
+using Clock = std::chrono::steady_clock;
+
+// Images larger than this (the 1-8 MiB parts) are produced in windows of
+// this size rather than in one chip-sized mapping.
+constexpr size_t WINDOW_BYTES = 512 * 1024;
+
+// Per-conversion timings (nanoseconds) and byte counters for --stats.
+struct Stats {
+    uint64_t read_ns = 0;   // opening/mapping the ROM (and the --base image), or waiting for its prefetch
+    uint64_t pad_ns = 0;    // padding, start-bank and --type auto resolution
+    uint64_t place_ns = 0;  // 0xFF fill and bank copies (and --checksum)
+    uint64_t write_ns = 0;  // creating, encoding and committing the output
+    uint64_t verify_ns = 0;
+    uint64_t bytes_read = 0;
+    uint64_t banks_written = 0;
+    uint64_t bytes_filled = 0;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_verified = 0;
+    bool cache_hit = false;
+    bool checksummed = false; // --checksum: the image's checksums below
+    uint32_t crc32 = 0;
+    uint16_t sum16 = 0;
+    std::string sha1;
+
+    uint64_t total_ns() const { return read_ns + pad_ns + place_ns + write_ns + verify_ns; }
+
+    void set_checksums(const ImageChecksum& sums) {
+        checksummed = true;
+        crc32 = sums.crc32();
+        sum16 = sums.sum16();
+        sha1 = sums.sha1();
+    }
+
+    void add(const Stats& o) {
+        read_ns += o.read_ns;
+        pad_ns += o.pad_ns;
+        place_ns += o.place_ns;
+        write_ns += o.write_ns;
+        verify_ns += o.verify_ns;
+        bytes_read += o.bytes_read;
+        banks_written += o.banks_written;
+        bytes_filled += o.bytes_filled;
+        bytes_written += o.bytes_written;
+        bytes_verified += o.bytes_verified;
+    }
+};
+
+// Charges the time since the previous lap to one phase counter.
+class Stopwatch {
+public:
+    void lap(uint64_t& ns) {
+        auto now = Clock::now();
+        ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - t_).count());
+        t_ = now;
+    }
+
+private:
+    Clock::time_point t_ = Clock::now();
+};
+
+// Turn a library status into the tool's bool + error text.
+bool ok(Status s, std::string& err);
+
+// A verify status as the --verify error text.
+bool verified(Status s, size_t bad_bank, std::string& err);
+
+bool read_file(const std::string& path, std::vector<uint8_t>& buf, std::string& err);
+
+// Outputs are written under a temporary name next to their target and renamed
+// over it once complete, so a job killed halfway leaves the previous file (or
+// none), never a torn image. Targets that aren't regular files (/dev/null, a
+// FIFO, a symlink) are written in place.
+// A Staged entry without tmp removes path when its group is committed (a side
+// file an earlier run left that no longer applies).
+struct Staged {
+    std::string tmp;
+    std::string path;
+    size_t job = 0; // the batch job it belongs to
+};
+
+// The temporary name a new version of path is written under: a hidden file in
+// the same directory, so the rename stays on one file system.
+std::string staging_name(const std::string& path);
+
+// One output under construction: written at tmp(), then put in place by
+// publish(). Dropped unpublished (a failed job), the partial file is removed.
+class StagedFile {
+public:
+    explicit StagedFile(std::string path) : path_(std::move(path)), tmp_(staging_name(path_)) {}
+    StagedFile(const StagedFile&) = delete;
+    StagedFile& operator=(const StagedFile&) = delete;
+    ~StagedFile();
+
+    const std::string& tmp() const { return tmp_; }
+
+    // Rename the finished file over its target now or, with staged, leave it
+    // for the caller to commit with a group (commit_staged).
+    bool publish(std::vector<Staged>* staged, std::string& err);
+
+private:
+    std::string path_;
+    std::string tmp_;
+    bool done_ = false;
+};
+
+// Remove the temporaries of staged files that won't be committed.
+void discard_staged(const std::vector<Staged>& files, size_t from = 0);
+
+// Put a group of staged files in place; failed gets an error for every job
+// of the group that didn't fully succeed, so the results match the disk.
+// When durable, one syncfs() per file system first flushes the data of all of
+// them (an fsync() per file where there is no syncfs), and one fsync() per
+// target directory after the renames makes those durable; after a crash
+// every target is then its previous version or the complete new one.
+// - Nothing is replaced if a directory can't be opened or the data can't be
+//   flushed: every job fails and the temporaries are removed.
+// - A file that can't be renamed fails its job, whose later files are dropped
+//   and earlier ones (side files come before the image) stay replaced; the
+//   error says so. Other jobs go on.
+// - A directory that can't be flushed fails the jobs that renamed files into
+//   it; their outputs are in place but may not survive a crash.
+void commit_staged(const std::vector<Staged>& files, bool durable, std::map<size_t, std::string>& failed);
+
+// commit_staged() for the files of a single job: false with err if it failed.
+bool commit_job(const std::vector<Staged>& files, bool durable, std::string& err);
+
+// Write len bytes to path as it stands (a staged temporary, or a device).
+bool put_file(const std::string& path, const uint8_t* data, size_t len, std::string& err);
+
+// Replace path with len bytes, through a staged temporary (left in staged
+// for a group commit, if given).
+bool write_file(const std::string& path, const uint8_t* data, size_t len, std::string& err,
+                std::vector<Staged>* staged = nullptr);
+
+// Read-only view of an input file. Regular files are mapped so the placement
+// loop copies straight out of the page cache; anything that can't be mapped
+// (empty files, pipes, non-POSIX builds) is read into memory instead.
+class InputFile {
+public:
+    InputFile() = default;
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+    ~InputFile();
+
+    bool open(const std::string& path, std::string& err);
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> buf_;
+};
+
+// Writable image of an output file, created at its final size. The file is
+// mapped shared so bytes stored into data() land in the page cache directly;
+// if mapping isn't possible (or map is false) the image is buffered in memory
+// (in buf, if given, so a worker can reuse it) and commit() writes it out.
+class OutputFile {
+public:
+    OutputFile() = default;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile();
+
+    bool create(const std::string& path, size_t size, bool map, std::string& err,
+                std::vector<uint8_t>* buf = nullptr);
+
+    uint8_t* data() { return data_; }
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+    // Hand the finished image to the file system.
+    bool commit(std::string& err);
+
+private:
+    // Create the file at size_ and map it; leaves mapped_ false (and the
+    // caller buffering) when the target isn't a regular file.
+    bool map_file(std::string& err);
+
+    std::string path_;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    int fd_ = -1;
+    std::vector<uint8_t> own_;
+    std::vector<uint8_t>* buf_ = &own_;
+};
+
+// rom2msx::verify() with the --verify error texts.
+bool verify_image(const uint8_t* img, size_t img_bytes, const Placement* pl, size_t count, std::string& err);
+
+// Verify an image that was already committed by mapping it back from disk.
+bool verify_file(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count,
+                 std::string& err);
+
+// Write a raw chip image window by window: every window a ROM reaches is
+// rendered into one reusable buffer (and checked there for --verify=mapped),
+// the others are written from a shared blank one. Memory use stays at two
+// windows whatever the chip size, and no byte is stored twice. sums, if
+// given, gets the image as it is rendered; win is the window buffer.
+bool write_windows(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count, bool verify,
+                   ImageChecksum* sums, std::vector<uint8_t>& win, Stopwatch& sw, Stats& st, std::string& err);
+
+#ifndef _WIN32
+// Write a raw chip image without assembling it: writev() takes the ROM data
+// straight from the input mappings and every gap (leading banks, padding
+// tails, the rest of the chip) from one shared blank buffer, so no byte of
+// the image is stored in memory at all. sums, if given, gets the image on the
+// way.
+bool write_spans(const std::string& path, size_t chip_bytes, const Placement* pl, size_t count,
+                 ImageChecksum* sums, Stopwatch& sw, Stats& st, std::string& err);
+#endif
+
+#ifdef ROM2MSX_IO_URING
+// The little of io_uring the prefetcher needs, on the raw system calls:
+// queue a read, wait for the next completion. Only one thread uses a ring.
+class Ring {
+public:
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+    ~Ring();
+
+    bool init(unsigned entries);
+
+    bool read(int fd, uint8_t* buf, size_t len, size_t off, uint64_t tag);
+
+    // Block until a read completes; res is its byte count or -errno.
+    bool wait(uint64_t& tag, int& res);
+
+private:
+    int fd_ = -1;
+    void* sq_ = nullptr;
+    void* cq_ = nullptr;
+    void* sqes_ = nullptr;
+    size_t sq_len_ = 0, cq_len_ = 0, sqes_len_ = 0;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+};
+#endif
+
+} // namespace io
+} // namespace rom2msx
+
+#endif // ROM2MSX_IO_HPP